@@ -19,9 +19,9 @@ bool ArArchive::load(const char* filename) {
 	FILE* fp = fopen(filename, "rb");
 	if (fp == nullptr)
 		return false;
-	fseek(fp, 0, SEEK_END);
-	uint32_t fileSize = ftell(fp);
-	fseek(fp, 0, SEEK_SET);
+	fseeko(fp, 0, SEEK_END);
+	uint64_t fileSize = ftello(fp);
+	fseeko(fp, 0, SEEK_SET);
 
 	// Check magic
 	char magic[ArMagicLen];
@@ -31,9 +31,9 @@ bool ArArchive::load(const char* filename) {
 		return false;
 
 	// Read files
-	while (!feof(fp) && static_cast<uint32_t>(ftell(fp)) < fileSize) {
+	while (!feof(fp) && static_cast<uint64_t>(ftello(fp)) < fileSize) {
 		// each file is placed at an even byte offset
-		if (ftell(fp) % 2 > 0) {
+		if (ftello(fp) % 2 > 0) {
 			if (!fgetc(fp))
 				return false;
 		}
@@ -47,16 +47,16 @@ bool ArArchive::load(const char* filename) {
 			return false;
 		if (!parseFileName(header.ar_name, entry.name))
 			return false;
-		entry.size = static_cast<uint32_t>(strtoul(header.ar_size, nullptr, 10));
-		entry.offset = ftell(fp);
-		if (entry.size == 0)
+		entry.size = strtoull(header.ar_size, nullptr, 10);
+		entry.offset = ftello(fp);
+		if (entry.size == 0 || entry.size > SIZE_MAX)
 			return false;
 
 		// Read the file
-		entry.buffer = malloc(entry.size);
+		entry.buffer = malloc(static_cast<size_t>(entry.size));
 		if (entry.buffer == nullptr)
 			return false;
-		if (fread(entry.buffer, 1, entry.size, fp) != entry.size)
+		if (fread(entry.buffer, 1, static_cast<size_t>(entry.size), fp) != entry.size)
 			return false;
 
 		files.push_back(entry);
@@ -131,11 +131,11 @@ bool ArArchive::parseFileName(const char* inName, std::string& outName) {
 		uint32_t strTableIdx = getFileIndex("//");
 		if (strTableIdx == UINT32_MAX)
 			return false;
-		uint32_t strTableSize = getFileSize(strTableIdx);
+		uint64_t strTableSize = getFileSize(strTableIdx);
 		const char* strTableBuffer = reinterpret_cast<char*>(getFileBuffer(strTableIdx));
 
 		uint32_t offset = ar_atou(inName + 1, 15); // no need for validation
-		uint32_t endOffset = offset;
+		uint64_t endOffset = offset;
 		while (endOffset < strTableSize && strTableBuffer[endOffset] != '/')
 			endOffset++;
 		if (endOffset >= strTableSize)
@@ -165,14 +165,14 @@ const char* ArArchive::getFileName(uint32_t index) const {
 		return files[index].name.c_str();
 }
 
-uint32_t ArArchive::getFileSize(uint32_t index) const {
+uint64_t ArArchive::getFileSize(uint32_t index) const {
 	if (index >= files.size())
 		return 0;
 	else
 		return files[index].size;
 }
 
-uint32_t ArArchive::getFileOffset(uint32_t index) const {
+uint64_t ArArchive::getFileOffset(uint32_t index) const {
 	if (index >= files.size())
 		return 0;
 	else
@@ -0,0 +1,242 @@
+#include "pbw_api_info.h"
+
+#include <algorithm>
+#include <errno.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+static constexpr char JournalMagic[8] = { 'P', 'B', 'W', 'J', 'O', 'U', 'R', 'N' };
+static constexpr uint32_t JournalVersion = 1;
+static constexpr uint32_t JournalHeaderSize = 16; // magic, version, flags
+static constexpr uint32_t RecordMagic = 0x4a574250; // "PBWJ"
+static constexpr uint32_t RecordHeaderSize = 20; // magic, path size, result offset and size
+static constexpr uint32_t RecordChecksumSize = 4;
+static constexpr uint32_t SyncGroupSize = 256; // records
+static constexpr uint32_t SyncIntervalMilliseconds = 1000;
+
+static uint32_t readLE32(const uint8_t* p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static uint64_t readLE64(const uint8_t* p) {
+	return readLE32(p) | (static_cast<uint64_t>(readLE32(p + 4)) << 32);
+}
+
+static void appendLE32(std::string& data, uint32_t value) {
+	for (int i = 0; i < 4; i++)
+		data.push_back(static_cast<char>((value >> (i * 8)) & 0xff));
+}
+
+static void appendLE64(std::string& data, uint64_t value) {
+	appendLE32(data, static_cast<uint32_t>(value));
+	appendLE32(data, static_cast<uint32_t>(value >> 32));
+}
+
+#ifndef WIN32
+static bool writeAll(int fd, const char* data, size_t size, off_t offset = -1) {
+	size_t written = 0;
+	while (written < size) {
+		ssize_t result = offset < 0 ? write(fd, data + written, size - written) : pwrite(fd, data + written, size - written, offset + written);
+		if (result < 0 && errno == EINTR)
+			continue;
+		if (result <= 0)
+			return false;
+		written += result;
+	}
+	return true;
+}
+#endif
+
+BatchJournal::BatchJournal(bool verb) : journalFd(-1), dataFd(-1), dataSize(0), verbose(verb), pendingCount(0) {
+}
+
+BatchJournal::~BatchJournal() {
+#ifndef WIN32
+	if (journalFd >= 0 && dataFd >= 0)
+		sync();
+	if (journalFd >= 0)
+		close(journalFd);
+	if (dataFd >= 0)
+		close(dataFd);
+#endif
+}
+
+bool BatchJournal::open(const std::string& journalPath, const std::string& dataPath, uint32_t flags, bool resume) {
+#ifdef WIN32
+	verbose && std::cerr << "The batch journal is not supported on windows" << std::endl;
+	return false;
+#else
+	int openFlags = O_RDWR | O_CREAT | O_CLOEXEC | (resume ? 0 : O_TRUNC);
+	journalFd = ::open(journalPath.c_str(), openFlags, 0644);
+	dataFd = ::open(dataPath.c_str(), openFlags, 0644);
+	if (journalFd < 0 || dataFd < 0) {
+		verbose && std::cerr << "Could not open batch journal: " << strerror(errno) << std::endl;
+		return false;
+	}
+
+	std::string journal;
+	char buffer[64 * 1024];
+	ssize_t size;
+	while ((size = read(journalFd, buffer, sizeof(buffer))) != 0) {
+		if (size < 0 && errno == EINTR)
+			continue;
+		if (size < 0)
+			return false;
+		journal.append(buffer, size);
+	}
+
+	// a new journal, or one that died before its header was synced
+	if (journal.size() < JournalHeaderSize) {
+		std::string header(JournalMagic, sizeof(JournalMagic));
+		appendLE32(header, JournalVersion);
+		appendLE32(header, flags);
+		if (ftruncate(journalFd, 0) != 0 || ftruncate(dataFd, 0) != 0 || !writeAll(journalFd, header.data(), header.size()) || fdatasync(journalFd) != 0)
+			return false;
+		lastSync = std::chrono::steady_clock::now();
+		return true;
+	}
+
+	uint64_t validSize, dataEnd;
+	if (!readRecords(journal, flags, validSize, dataEnd))
+		return false;
+	struct stat dataStat;
+	if (fstat(dataFd, &dataStat) != 0 || static_cast<uint64_t>(dataStat.st_size) < dataEnd) {
+		verbose && std::cerr << "The results of the batch journal are incomplete" << std::endl;
+		return false;
+	}
+
+	// results after the last synced group were never journaled, their inputs are scanned again
+	if (validSize < journal.size() && ftruncate(journalFd, static_cast<off_t>(validSize)) != 0)
+		return false;
+	if (static_cast<uint64_t>(dataStat.st_size) > dataEnd && ftruncate(dataFd, static_cast<off_t>(dataEnd)) != 0)
+		return false;
+	if (lseek(journalFd, 0, SEEK_END) < 0)
+		return false;
+	dataSize = dataEnd;
+	lastSync = std::chrono::steady_clock::now();
+	verbose && std::cerr << "Resuming after " << entries.size() << " finished inputs" << std::endl;
+	return true;
+#endif
+}
+
+// stops at the first record that is incomplete or damaged, validSize is where the next record belongs
+bool BatchJournal::readRecords(const std::string& journal, uint32_t flags, uint64_t& validSize, uint64_t& dataEnd) {
+	const uint8_t* data = reinterpret_cast<const uint8_t*>(journal.data());
+	if (memcmp(data, JournalMagic, sizeof(JournalMagic)) != 0 || readLE32(data + sizeof(JournalMagic)) != JournalVersion) {
+		verbose && std::cerr << "Not a batch journal" << std::endl;
+		return false;
+	}
+	if (readLE32(data + sizeof(JournalMagic) + 4) != flags) {
+		verbose && std::cerr << "The batch journal was written with different output options" << std::endl;
+		return false;
+	}
+
+	size_t offset = JournalHeaderSize;
+	dataEnd = 0;
+	while (journal.size() - offset >= RecordHeaderSize + RecordChecksumSize) {
+		const uint8_t* record = data + offset;
+		uint32_t pathSize = readLE32(record + 4);
+		if (readLE32(record) != RecordMagic || pathSize > journal.size() - offset - RecordHeaderSize - RecordChecksumSize)
+			break;
+		size_t recordSize = RecordHeaderSize + pathSize;
+		if (mz_crc32(MZ_CRC32_INIT, record, recordSize) != readLE32(record + recordSize))
+			break;
+
+		Entry entry;
+		entry.offset = readLE64(record + 8);
+		entry.size = readLE32(record + 16);
+		entries[std::string(reinterpret_cast<const char*>(record + RecordHeaderSize), pathSize)] = entry;
+		dataEnd = std::max(dataEnd, entry.offset + entry.size);
+		offset += recordSize + RecordChecksumSize;
+	}
+	validSize = offset;
+	return true;
+}
+
+bool BatchJournal::isFinished(const std::string& input) {
+	std::lock_guard<std::mutex> lock(mutex);
+	return entries.find(input) != entries.end();
+}
+
+bool BatchJournal::readResult(const std::string& input, std::string& result) {
+#ifdef WIN32
+	return false;
+#else
+	std::lock_guard<std::mutex> lock(mutex);
+	auto itEntry = entries.find(input);
+	if (itEntry == entries.end())
+		return false;
+	result.resize(itEntry->second.size);
+	size_t done = 0;
+	while (done < result.size()) {
+		ssize_t size = pread(dataFd, &result[done], result.size() - done, static_cast<off_t>(itEntry->second.offset + done));
+		if (size < 0 && errno == EINTR)
+			continue;
+		if (size <= 0)
+			return false;
+		done += size;
+	}
+	return true;
+#endif
+}
+
+bool BatchJournal::append(const std::string& input, const std::string& result) {
+#ifdef WIN32
+	return false;
+#else
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!writeAll(dataFd, result.data(), result.size(), static_cast<off_t>(dataSize)))
+		return false;
+
+	Entry& entry = entries[input];
+	entry.offset = dataSize;
+	entry.size = static_cast<uint32_t>(result.size());
+	dataSize += result.size();
+
+	size_t recordStart = pendingRecords.size();
+	appendLE32(pendingRecords, RecordMagic);
+	appendLE32(pendingRecords, static_cast<uint32_t>(input.size()));
+	appendLE64(pendingRecords, entry.offset);
+	appendLE32(pendingRecords, entry.size);
+	pendingRecords.append(input);
+	appendLE32(pendingRecords, static_cast<uint32_t>(mz_crc32(MZ_CRC32_INIT, reinterpret_cast<const uint8_t*>(pendingRecords.data() + recordStart), pendingRecords.size() - recordStart)));
+	pendingCount++;
+
+	// one sync for many results, a crash loses at most the results of the last group
+	if (pendingCount >= SyncGroupSize || std::chrono::steady_clock::now() - lastSync >= std::chrono::milliseconds(SyncIntervalMilliseconds))
+		return syncPending();
+	return true;
+#endif
+}
+
+bool BatchJournal::sync() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return syncPending();
+}
+
+bool BatchJournal::syncPending() {
+#ifdef WIN32
+	return false;
+#else
+	lastSync = std::chrono::steady_clock::now();
+	if (pendingCount == 0)
+		return true;
+	bool success = fdatasync(dataFd) == 0 &&
+		writeAll(journalFd, pendingRecords.data(), pendingRecords.size()) &&
+		fdatasync(journalFd) == 0;
+	pendingRecords.clear();
+	pendingCount = 0;
+	if (!success)
+		verbose && std::cerr << "Could not sync batch journal: " << strerror(errno) << std::endl;
+	return success;
+#endif
+}
+
+uint32_t BatchJournal::getFinishedCount() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return static_cast<uint32_t>(entries.size());
+}
@@ -0,0 +1,292 @@
+#include "pbw_api_info.h"
+
+static constexpr uint32_t SpinsBeforeYield = 64;
+static constexpr uint32_t YieldsBeforeSleep = 16;
+static constexpr uint32_t SleepMicroseconds = 50;
+static constexpr uint32_t BinariesPerApp = 8; // capacity hint for the queue of binaries waiting to be inflated
+
+struct BatchPipeline::AppJob {
+	uint32_t inputIndex;
+	InputBudget budget; // started when an inflater picks up the first binary, waiting in a queue is not charged
+	std::once_flag budgetStarted;
+	std::vector<uint8_t>* fileBuffer = nullptr; // the whole input if it was prefetched, has to outlive the archive
+	PblAppArchive archive;
+	std::vector<PblAppBinary*> binaries; // indexed like the binaries in the archive
+	std::vector<std::string> errors; // indexed like the binaries in the archive
+	std::atomic<uint32_t> remaining;
+	BatchScanner::AppResult result; // filled by the last finished binary
+};
+
+// waits for a queue that is full or empty, a short spin first and a sleep if the wait gets longer
+class Backoff {
+	uint32_t count = 0;
+public:
+	void wait() {
+		if (count >= SpinsBeforeYield + YieldsBeforeSleep)
+			std::this_thread::sleep_for(std::chrono::microseconds(SleepMicroseconds));
+		else if (count >= SpinsBeforeYield)
+			std::this_thread::yield();
+		count++;
+	}
+
+	void reset() {
+		count = 0;
+	}
+};
+
+template<typename T>
+static void pushBlocking(BoundedQueue<T>& queue, const T& value) {
+	Backoff backoff;
+	while (!queue.tryPush(value))
+		backoff.wait();
+}
+
+// returns false once the producers are finished and the queue is drained
+template<typename T>
+static bool popBlocking(BoundedQueue<T>& queue, T& value, const std::atomic<uint32_t>& activeProducers) {
+	Backoff backoff;
+	while (true) {
+		bool producersDone = activeProducers.load() == 0;
+		if (queue.tryPop(value))
+			return true;
+		if (producersDone)
+			return false;
+		backoff.wait();
+	}
+}
+
+static BatchPipeline::Config normalizeConfig(BatchPipeline::Config config) {
+	if (config.readThreads == 0)
+		config.readThreads = 1;
+	if (config.inflateThreads == 0)
+		config.inflateThreads = 1;
+	if (config.scanThreads == 0) {
+		uint32_t cores = std::thread::hardware_concurrency();
+		uint32_t used = config.readThreads + config.inflateThreads;
+		config.scanThreads = cores > used ? cores - used : 1;
+	}
+	if (config.window == 0)
+		config.window = 4 * (config.readThreads + config.inflateThreads + config.scanThreads);
+	return config;
+}
+
+BatchPipeline::BatchPipeline(const std::vector<PblLibrary*>& libs, const Config& conf, bool verb) :
+	libraries(libs), config(normalizeConfig(conf)), cache(nullptr), verbose(verb), inputs(nullptr),
+	bufferPool(config.window), bytesRead(0), nextInput(0), emittedCount(0), activeReaders(0), activeInflaters(0), activeScanners(0),
+	inflateQueue(config.window * BinariesPerApp),
+	scanQueue(2 * config.scanThreads), // extracted binaries are the big allocations, keep only a few waiting
+	emitQueue(config.window) {
+}
+
+void BatchPipeline::setResultCache(ResultCache* resultCache) {
+	cache = resultCache;
+}
+
+void BatchPipeline::setBudget(const InputBudget::Limits& limits) {
+	budgetLimits = limits;
+}
+
+PblLibrary* BatchPipeline::findLibrary(const char* platformName) const {
+	for (auto itLibrary = libraries.begin(); itLibrary != libraries.end(); ++itLibrary) {
+		if (strcmp((*itLibrary)->getPlatformName(), platformName) == 0)
+			return *itLibrary;
+	}
+	return nullptr;
+}
+
+void BatchPipeline::scan(const std::vector<std::string>& inputList, const BatchScanner::ResultCallback& callback) {
+	inputs = &inputList;
+	nextInput = 0;
+	emittedCount = 0;
+	activeReaders = config.readThreads;
+	activeInflaters = config.inflateThreads;
+	activeScanners = config.scanThreads;
+	bytesRead = 0;
+	auto startTime = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> threads;
+	for (uint32_t i = 0; i < config.readThreads; i++)
+		threads.emplace_back(config.prefetch ? &BatchPipeline::runPrefetchReader : &BatchPipeline::runReader, this);
+	for (uint32_t i = 0; i < config.inflateThreads; i++)
+		threads.emplace_back(&BatchPipeline::runInflater, this);
+	for (uint32_t i = 0; i < config.scanThreads; i++)
+		threads.emplace_back(&BatchPipeline::runScanner, this);
+
+	// finished apps arrive out of order, they wait here until all previous inputs are emitted
+	std::vector<AppJob*> pending(inputList.size(), nullptr);
+	uint32_t nextEmit = 0;
+	AppJob* job;
+	while (nextEmit < inputList.size() && popBlocking(emitQueue, job, activeScanners)) {
+		pending[job->inputIndex] = job;
+		while (nextEmit < inputList.size() && pending[nextEmit] != nullptr) {
+			AppJob* next = pending[nextEmit];
+			callback(next->inputIndex, next->result);
+			std::vector<uint8_t>* fileBuffer = next->fileBuffer;
+			delete next;
+			bufferPool.release(fileBuffer);
+			pending[nextEmit] = nullptr;
+			nextEmit++;
+			emittedCount.store(nextEmit);
+		}
+	}
+
+	for (auto itThread = threads.begin(); itThread != threads.end(); ++itThread)
+		itThread->join();
+	inputs = nullptr;
+
+	// the same numbers for every reader, so prefetching with io_uring and pread can be compared
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	if (verbose && seconds > 0) {
+		std::cerr << "Scanned " << inputList.size() << " inputs in " << seconds << " s (" << inputList.size() / seconds << " inputs/s";
+		if (config.prefetch)
+			std::cerr << ", " << bytesRead / seconds / (1024 * 1024) << " MiB/s read";
+		std::cerr << ")" << std::endl;
+	}
+}
+
+// claims the next input unless too many apps are in flight already
+bool BatchPipeline::claimInput(uint32_t& inputIndex) {
+	uint32_t index = nextInput.load();
+	do {
+		if (index >= inputs->size() || index - emittedCount.load() >= config.window)
+			return false;
+	} while (!nextInput.compare_exchange_weak(index, index + 1));
+	inputIndex = index;
+	return true;
+}
+
+void BatchPipeline::runReader() {
+	Backoff backoff;
+	while (nextInput.load() < inputs->size()) {
+		// backpressure on the emitter: a slow input must not let the reorder buffer grow
+		uint32_t inputIndex;
+		if (!claimInput(inputIndex)) {
+			backoff.wait();
+			continue;
+		}
+		backoff.reset();
+		startApp(inputIndex, nullptr);
+	}
+	activeReaders--;
+}
+
+void BatchPipeline::runPrefetchReader() {
+	CorpusReader reader(config.prefetchMode, config.prefetchDepth, bufferPool, verbose);
+	Backoff backoff;
+	while (true) {
+		// never wait for a free window slot here, the emitter may wait for a read that is still in flight
+		uint32_t inputIndex;
+		while (reader.canSubmit() && claimInput(inputIndex))
+			reader.submit(inputIndex, (*inputs)[inputIndex]);
+
+		CorpusReader::File file;
+		if (!reader.next(file)) {
+			if (nextInput.load() >= inputs->size())
+				break;
+			backoff.wait();
+			continue;
+		}
+		backoff.reset();
+		startApp(file.index, file.buffer);
+	}
+	bytesRead += reader.getBytesRead();
+	activeReaders--;
+}
+
+void BatchPipeline::startApp(uint32_t inputIndex, std::vector<uint8_t>* fileBuffer) {
+	AppJob* job = new AppJob();
+	job->inputIndex = inputIndex;
+	job->fileBuffer = fileBuffer;
+	bool loaded;
+	if (!config.prefetch)
+		loaded = job->archive.load((*inputs)[inputIndex].c_str(), verbose);
+	else if (fileBuffer != nullptr)
+		loaded = job->archive.loadFromMemory(fileBuffer->data(), fileBuffer->size(), verbose);
+	else {
+		verbose && std::cerr << "Could not read \"" << (*inputs)[inputIndex] << "\"" << std::endl;
+		loaded = false;
+	}
+	if (!loaded) {
+		job->result.errors.push_back("Could not open pebble app archive");
+		pushBlocking(emitQueue, job);
+		return;
+	}
+
+	uint32_t binaryCount = job->archive.getBinaryCount();
+	job->binaries.resize(binaryCount, nullptr);
+	job->errors.resize(binaryCount);
+	job->remaining = binaryCount;
+	if (binaryCount == 0) {
+		finishApp(job);
+		return;
+	}
+	for (uint32_t i = 0; i < binaryCount; i++) {
+		BinaryItem item;
+		item.job = job;
+		item.binaryIndex = i;
+		item.buffer = nullptr;
+		item.size = 0;
+		pushBlocking(inflateQueue, item);
+	}
+}
+
+void BatchPipeline::runInflater() {
+	BinaryItem item;
+	while (popBlocking(inflateQueue, item, activeReaders)) {
+		std::call_once(item.job->budgetStarted, [&]() { item.job->budget.start(budgetLimits); });
+		const char* platformName = item.job->archive.getBinaryPlatform(item.binaryIndex);
+		if (findLibrary(platformName) != nullptr && !item.job->budget.isExceeded())
+			item.buffer = item.job->archive.extractBinary(item.binaryIndex, &item.size, verbose, cache != nullptr ? item.hash : nullptr, &item.job->budget);
+		pushBlocking(scanQueue, item);
+	}
+	activeInflaters--;
+}
+
+void BatchPipeline::runScanner() {
+	BinaryItem item;
+	while (popBlocking(scanQueue, item, activeInflaters)) {
+		AppJob* job = item.job;
+		const char* platformName = job->archive.getBinaryPlatform(item.binaryIndex);
+		PblLibrary* library = findLibrary(platformName);
+		if (library == nullptr) {
+			verbose && std::cerr << "Library for pebble binary \"" << platformName << "\" not loaded" << std::endl;
+			job->errors[item.binaryIndex] = std::string("Library for ") + platformName + " not loaded";
+		}
+		else if (item.buffer != nullptr) {
+			PblAppBinary* binary = new PblAppBinary(item.buffer, item.size, library);
+			binary->scan(cache, item.hash, &job->budget);
+			binary->releaseBuffer();
+			job->binaries[item.binaryIndex] = binary;
+		}
+		else
+			job->errors[item.binaryIndex] = std::string("Could not extract binary for ") + platformName;
+
+		if (--job->remaining == 0)
+			finishApp(job);
+	}
+	activeScanners--;
+}
+
+void BatchPipeline::finishApp(AppJob* job) {
+	BatchScanner::AppResult& result = job->result;
+	// nothing of an input over budget is reported, its results may be incomplete
+	if (job->budget.isExceeded()) {
+		for (auto itBinary = job->binaries.begin(); itBinary != job->binaries.end(); ++itBinary)
+			delete *itBinary;
+		job->binaries.clear();
+		verbose && std::cerr << job->budget.getError() << std::endl;
+		result.errors.push_back(job->budget.getError());
+		pushBlocking(emitQueue, job);
+		return;
+	}
+	for (uint32_t i = 0; i < job->binaries.size(); i++) {
+		if (job->binaries[i] != nullptr)
+			result.binaries.push_back(job->binaries[i]);
+		if (!job->errors[i].empty())
+			result.errors.push_back(job->errors[i]);
+	}
+	job->binaries.clear();
+	if (result.binaries.empty())
+		result.errors.push_back("Could not scan any pebble binary");
+	pushBlocking(emitQueue, job);
+}
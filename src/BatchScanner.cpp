@@ -0,0 +1,119 @@
+#include "pbw_api_info.h"
+
+struct BatchScanner::AppJob {
+	uint32_t inputIndex;
+	InputBudget budget;
+	PblAppArchive archive;
+	std::vector<PblAppBinary*> binaries; // indexed like the binaries in the archive
+	std::vector<std::string> errors; // indexed like the binaries in the archive
+	std::atomic<uint32_t> remaining;
+};
+
+BatchScanner::AppResult::AppResult() {
+}
+
+BatchScanner::AppResult::~AppResult() {
+	for (auto itBinary = binaries.begin(); itBinary != binaries.end(); ++itBinary)
+		delete *itBinary;
+}
+
+BatchScanner::BatchScanner(const std::vector<PblLibrary*>& libs, uint32_t threadCount, bool verb) :
+	libraries(libs), pool(threadCount), cache(nullptr), verbose(verb) {
+}
+
+void BatchScanner::setResultCache(ResultCache* resultCache) {
+	cache = resultCache;
+}
+
+void BatchScanner::setBudget(const InputBudget::Limits& limits) {
+	budgetLimits = limits;
+}
+
+PblLibrary* BatchScanner::findLibrary(const char* platformName) const {
+	for (auto itLibrary = libraries.begin(); itLibrary != libraries.end(); ++itLibrary) {
+		if (strcmp((*itLibrary)->getPlatformName(), platformName) == 0)
+			return *itLibrary;
+	}
+	return nullptr;
+}
+
+void BatchScanner::scan(const std::vector<std::string>& inputs, const ResultCallback& callback) {
+	for (uint32_t i = 0; i < inputs.size(); i++) {
+		const std::string& input = inputs[i];
+		pool.submit([this, i, &input, &callback]() {
+			openApp(i, input, callback);
+		});
+	}
+	pool.wait();
+}
+
+void BatchScanner::openApp(uint32_t inputIndex, const std::string& input, const ResultCallback& callback) {
+	std::shared_ptr<AppJob> job = std::make_shared<AppJob>();
+	job->inputIndex = inputIndex;
+	job->budget.start(budgetLimits);
+	if (!job->archive.load(input.c_str(), verbose)) {
+		AppResult result;
+		result.errors.push_back("Could not open pebble app archive");
+		callback(inputIndex, result);
+		return;
+	}
+
+	uint32_t binaryCount = job->archive.getBinaryCount();
+	job->binaries.resize(binaryCount, nullptr);
+	job->errors.resize(binaryCount);
+	job->remaining = binaryCount;
+	for (uint32_t i = 0; i < binaryCount; i++) {
+		pool.submit([this, job, i, &callback]() {
+			scanBinary(job, i, callback);
+		});
+	}
+}
+
+void BatchScanner::scanBinary(std::shared_ptr<AppJob> job, uint32_t binaryIndex, const ResultCallback& callback) {
+	const char* platformName = job->archive.getBinaryPlatform(binaryIndex);
+	PblLibrary* library = findLibrary(platformName);
+	if (library == nullptr) {
+		verbose && std::cerr << "Library for pebble binary \"" << platformName << "\" not loaded" << std::endl;
+		job->errors[binaryIndex] = std::string("Library for ") + platformName + " not loaded";
+	}
+	else if (!job->budget.isExceeded()) { // another binary of the app may have used it up already
+		size_t size;
+		uint8_t hash[Sha256::DigestSize];
+		void* buffer = job->archive.extractBinary(binaryIndex, &size, verbose, cache != nullptr ? hash : nullptr, &job->budget);
+		if (buffer != nullptr) {
+			PblAppBinary* binary = new PblAppBinary(buffer, size, library);
+			binary->scan(cache, hash, &job->budget);
+			binary->releaseBuffer();
+			job->binaries[binaryIndex] = binary;
+		}
+		else
+			job->errors[binaryIndex] = std::string("Could not extract binary for ") + platformName;
+	}
+
+	if (--job->remaining == 0)
+		finishApp(*job, callback);
+}
+
+void BatchScanner::finishApp(AppJob& job, const ResultCallback& callback) {
+	AppResult result;
+	// nothing of an input over budget is reported, its results may be incomplete
+	if (job.budget.isExceeded()) {
+		for (auto itBinary = job.binaries.begin(); itBinary != job.binaries.end(); ++itBinary)
+			delete *itBinary;
+		job.binaries.clear();
+		verbose && std::cerr << job.budget.getError() << std::endl;
+		result.errors.push_back(job.budget.getError());
+		callback(job.inputIndex, result);
+		return;
+	}
+	for (uint32_t i = 0; i < job.binaries.size(); i++) {
+		if (job.binaries[i] != nullptr)
+			result.binaries.push_back(job.binaries[i]);
+		if (!job.errors[i].empty())
+			result.errors.push_back(job.errors[i]);
+	}
+	job.binaries.clear();
+	if (result.binaries.empty())
+		result.errors.push_back("Could not scan any pebble binary");
+	callback(job.inputIndex, result);
+}
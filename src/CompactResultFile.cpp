@@ -0,0 +1,402 @@
+#include "pbw_api_info.h"
+
+#include <errno.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static constexpr char FileMagic[8] = { 'P', 'B', 'W', 'R', 'E', 'S', 'L', 'T' };
+static constexpr uint32_t FileVersion = 1;
+static constexpr uint32_t FileHeaderSize = 24; // magic, version, platform count, header size, checksum of the platform tables
+static constexpr uint32_t RecordMagic = 0x41574250; // "PBWA"
+static constexpr uint32_t RecordHeaderSize = 16; // magic, payload size, checksum of the payload, binary count, error count
+static constexpr uint32_t AppHeaderSize = 24; // uuid, input size, reserved
+static constexpr uint32_t BinaryHeaderSize = 8; // platform index, sdk version, reserved
+static constexpr uint32_t Alignment = 8; // of the records and the bitsets
+
+static uint32_t readLE16(const uint8_t* p) {
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t readLE32(const uint8_t* p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static void appendLE16(std::string& data, uint32_t value) {
+	data.push_back(static_cast<char>(value & 0xff));
+	data.push_back(static_cast<char>((value >> 8) & 0xff));
+}
+
+static void appendLE32(std::string& data, uint32_t value) {
+	for (int i = 0; i < 4; i++)
+		data.push_back(static_cast<char>((value >> (i * 8)) & 0xff));
+}
+
+static void writeLE32(std::string& data, size_t offset, uint32_t value) {
+	for (int i = 0; i < 4; i++)
+		data[offset + i] = static_cast<char>((value >> (i * 8)) & 0xff);
+}
+
+static void padToAlignment(std::string& data) {
+	data.append((Alignment - data.size() % Alignment) % Alignment, '\0');
+}
+
+static size_t bitsetSize(const CompactResultFile::Platform& platform) {
+	return (platform.functionNames.size() + 63) / 64 * 8;
+}
+
+/**
+ * checks the payload of a record and fills record if it is not nullptr
+ */
+static bool parseRecord(const uint8_t* payload, size_t size, uint32_t binaryCount, uint32_t errorCount,
+	const std::vector<CompactResultFile::Platform>& platforms, CompactResultFile::Record* record) {
+	if (size < AppHeaderSize)
+		return false;
+	size_t offset = AppHeaderSize;
+	uint32_t inputSize = readLE32(payload + 16);
+	for (uint32_t i = 0; i < binaryCount; i++) {
+		if (size - offset < BinaryHeaderSize)
+			return false;
+		uint32_t platformIndex = readLE16(payload + offset);
+		if (platformIndex >= platforms.size() || size - offset - BinaryHeaderSize < bitsetSize(platforms[platformIndex]))
+			return false;
+		if (record != nullptr)
+			record->binaries.push_back(CompactResultFile::Binary(&platforms[platformIndex], readLE16(payload + offset + 2), payload + offset + BinaryHeaderSize));
+		offset += BinaryHeaderSize + bitsetSize(platforms[platformIndex]);
+	}
+	if (size - offset < inputSize)
+		return false;
+	if (record != nullptr) {
+		memcpy(record->uuid, payload, sizeof(record->uuid));
+		record->input.assign(reinterpret_cast<const char*>(payload + offset), inputSize);
+	}
+	offset += inputSize;
+	for (uint32_t i = 0; i < errorCount; i++) {
+		if (size - offset < 4 || size - offset - 4 < readLE32(payload + offset))
+			return false;
+		uint32_t errorSize = readLE32(payload + offset);
+		if (record != nullptr)
+			record->errors.push_back(std::string(reinterpret_cast<const char*>(payload + offset + 4), errorSize));
+		offset += 4 + errorSize;
+	}
+	return size - offset < Alignment;
+}
+
+CompactResultFile::Binary::Binary(const Platform* p, uint16_t version, const uint8_t* b) :
+	platform(p), sdkVersion(version), bits(b) {
+	for (uint32_t i = 0; i < platform->functionNames.size(); i++) {
+		if (bits[i / 8] & (1 << (i % 8)))
+			usedOffsets.push_back(i);
+	}
+}
+
+const char* CompactResultFile::Binary::getPlatformName() const {
+	return platform->name.c_str();
+}
+
+uint16_t CompactResultFile::Binary::getSdkVersion() const {
+	return sdkVersion;
+}
+
+const uint8_t* CompactResultFile::Binary::getBits() const {
+	return bits;
+}
+
+uint32_t CompactResultFile::Binary::getUsedFunctionCount() const {
+	return usedOffsets.size();
+}
+
+const char* CompactResultFile::Binary::getUsedFunctionName(uint32_t index) const {
+	if (index >= usedOffsets.size())
+		return nullptr;
+	else
+		return platform->functionNames[usedOffsets[index]].c_str();
+}
+
+uint32_t CompactResultFile::Binary::getUsedFunctionSymbolTableOffset(uint32_t index) const {
+	if (index >= usedOffsets.size())
+		return UINT32_MAX;
+	else
+		return usedOffsets[index];
+}
+
+CompactResultFile::CompactResultFile() : fd(-1), mapping(nullptr), mappingSize(0) {
+}
+
+CompactResultFile::~CompactResultFile() {
+	unmap();
+#ifndef WIN32
+	if (fd >= 0)
+		close(fd);
+#endif
+}
+
+void CompactResultFile::unmap() {
+#ifndef WIN32
+	if (mapping != nullptr)
+		munmap(mapping, mappingSize);
+#endif
+	mapping = nullptr;
+	mappingSize = 0;
+}
+
+bool CompactResultFile::create(const std::string& path, const std::vector<PblLibrary*>& libraries, bool verbose) {
+#ifdef WIN32
+	(void)path;
+	(void)libraries;
+	verbose && std::cerr << "The compact result format is not supported on windows" << std::endl;
+	return false;
+#else
+	std::vector<Platform> libraryPlatforms(libraries.size());
+	for (uint32_t i = 0; i < libraries.size(); i++) {
+		Platform& platform = libraryPlatforms[i];
+		platform.name = libraries[i]->getPlatformName();
+		memcpy(platform.signature, libraries[i]->getSignature(), Sha256::DigestSize);
+		for (uint32_t j = 0; j < libraries[i]->getFunctionCount(); j++) {
+			uint32_t symbolTableOffset = libraries[i]->getFunctionSymbolTableOffset(j);
+			if (symbolTableOffset == UINT32_MAX)
+				continue;
+			if (symbolTableOffset >= platform.functionNames.size())
+				platform.functionNames.resize(symbolTableOffset + 1);
+			if (platform.functionNames[symbolTableOffset].empty())
+				platform.functionNames[symbolTableOffset] = libraries[i]->getFunctionName(j);
+		}
+	}
+
+	fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	struct stat fileStat;
+	if (fd < 0 || fstat(fd, &fileStat) != 0) {
+		verbose && std::cerr << "Could not open compact result file: " << strerror(errno) << std::endl;
+		return false;
+	}
+
+	bool success = true;
+	if (fileStat.st_size == 0) {
+		std::string header(FileMagic, sizeof(FileMagic));
+		appendLE32(header, FileVersion);
+		appendLE32(header, static_cast<uint32_t>(libraryPlatforms.size()));
+		appendLE32(header, 0); // header size
+		appendLE32(header, 0); // checksum
+		for (auto itPlatform = libraryPlatforms.begin(); itPlatform != libraryPlatforms.end(); ++itPlatform) {
+			appendLE32(header, static_cast<uint32_t>(itPlatform->name.size()));
+			header.append(itPlatform->name);
+			header.append(reinterpret_cast<const char*>(itPlatform->signature), Sha256::DigestSize);
+			appendLE32(header, static_cast<uint32_t>(itPlatform->functionNames.size()));
+			for (auto itName = itPlatform->functionNames.begin(); itName != itPlatform->functionNames.end(); ++itName) {
+				appendLE32(header, static_cast<uint32_t>(itName->size()));
+				header.append(*itName);
+			}
+		}
+		padToAlignment(header);
+		writeLE32(header, 16, static_cast<uint32_t>(header.size()));
+		writeLE32(header, 20, static_cast<uint32_t>(mz_crc32(MZ_CRC32_INIT, reinterpret_cast<const uint8_t*>(header.data()) + FileHeaderSize, header.size() - FileHeaderSize)));
+		success = write(fd, header.data(), header.size()) == static_cast<ssize_t>(header.size());
+	}
+	else {
+		// new records have to mean the same as the existing ones
+		mappingSize = static_cast<size_t>(fileStat.st_size);
+		mapping = mmap(nullptr, mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+		if (mapping == MAP_FAILED) {
+			mapping = nullptr;
+			success = false;
+		}
+		uint64_t validSize = 0;
+		if (success && !readFile(validSize)) {
+			verbose && std::cerr << "Not a compact result file" << std::endl;
+			success = false;
+		}
+		for (uint32_t i = 0; success && i < libraryPlatforms.size(); i++) {
+			success = libraryPlatforms.size() == platforms.size() && libraryPlatforms[i].name == platforms[i].name &&
+				memcmp(libraryPlatforms[i].signature, platforms[i].signature, Sha256::DigestSize) == 0;
+			if (!success)
+				verbose && std::cerr << "The compact result file was written with other libraries" << std::endl;
+		}
+		// a writer died in the middle of a record
+		if (success && validSize < mappingSize) {
+			verbose && std::cerr << "Removing " << (mappingSize - validSize) << " bytes of an incomplete record from the compact result file" << std::endl;
+			success = ftruncate(fd, static_cast<off_t>(validSize)) == 0;
+		}
+		unmap();
+		recordOffsets.clear();
+	}
+
+	if (!success) {
+		close(fd);
+		fd = -1;
+		return false;
+	}
+	platforms.swap(libraryPlatforms);
+	return true;
+#endif
+}
+
+bool CompactResultFile::append(const std::string& input, const BatchScanner::AppResult& result) {
+#ifdef WIN32
+	(void)input;
+	(void)result;
+	return false;
+#else
+	std::string record(RecordHeaderSize + AppHeaderSize, '\0');
+	writeLE32(record, 0, RecordMagic);
+	if (!result.binaries.empty())
+		memcpy(&record[RecordHeaderSize], result.binaries[0]->getUUID(), 16);
+	writeLE32(record, RecordHeaderSize + 16, static_cast<uint32_t>(input.size()));
+
+	uint32_t binaryCount = 0;
+	for (auto itBinary = result.binaries.begin(); itBinary != result.binaries.end(); ++itBinary) {
+		uint32_t platformIndex = 0;
+		while (platformIndex < platforms.size() && platforms[platformIndex].name != (*itBinary)->getPlatformName())
+			platformIndex++;
+		if (platformIndex >= platforms.size())
+			continue;
+		appendLE16(record, platformIndex);
+		appendLE16(record, (*itBinary)->getSdkVersion());
+		appendLE32(record, 0);
+		size_t bitsOffset = record.size();
+		record.append(bitsetSize(platforms[platformIndex]), '\0');
+		for (uint32_t i = 0; i < (*itBinary)->getUsedFunctionCount(); i++) {
+			uint32_t symbolTableOffset = (*itBinary)->getUsedFunctionSymbolTableOffset(i);
+			if (symbolTableOffset < platforms[platformIndex].functionNames.size())
+				record[bitsOffset + symbolTableOffset / 8] |= static_cast<char>(1 << (symbolTableOffset % 8));
+		}
+		binaryCount++;
+	}
+	record.append(input);
+	for (auto itError = result.errors.begin(); itError != result.errors.end(); ++itError) {
+		appendLE32(record, static_cast<uint32_t>(itError->size()));
+		record.append(*itError);
+	}
+	padToAlignment(record);
+
+	size_t payloadSize = record.size() - RecordHeaderSize;
+	writeLE32(record, 4, static_cast<uint32_t>(payloadSize));
+	writeLE32(record, 8, static_cast<uint32_t>(mz_crc32(MZ_CRC32_INIT, reinterpret_cast<const uint8_t*>(record.data()) + RecordHeaderSize, payloadSize)));
+	record[12] = static_cast<char>(binaryCount & 0xff);
+	record[13] = static_cast<char>(binaryCount >> 8);
+	record[14] = static_cast<char>(result.errors.size() & 0xff);
+	record[15] = static_cast<char>(result.errors.size() >> 8);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (fd < 0)
+		return false;
+	size_t written = 0;
+	while (written < record.size()) {
+		ssize_t size = write(fd, record.data() + written, record.size() - written);
+		if (size < 0 && errno == EINTR)
+			continue;
+		if (size <= 0)
+			break;
+		written += size;
+	}
+	return written == record.size();
+#endif
+}
+
+bool CompactResultFile::load(const std::string& path, bool verbose) {
+#ifdef WIN32
+	(void)path;
+	verbose && std::cerr << "The compact result format is not supported on windows" << std::endl;
+	return false;
+#else
+	fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	struct stat fileStat;
+	if (fd < 0 || fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+		verbose && std::cerr << "Could not open compact result file: " << strerror(errno) << std::endl;
+		return false;
+	}
+	mappingSize = static_cast<size_t>(fileStat.st_size);
+	mapping = mmap(nullptr, mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+	if (mapping == MAP_FAILED) {
+		mapping = nullptr;
+		verbose && std::cerr << "Could not map compact result file: " << strerror(errno) << std::endl;
+		return false;
+	}
+
+	uint64_t validSize = 0;
+	if (!readFile(validSize)) {
+		verbose && std::cerr << "Not a compact result file" << std::endl;
+		return false;
+	}
+	if (validSize < mappingSize)
+		verbose && std::cerr << "Ignoring " << (mappingSize - validSize) << " bytes of an incomplete record at the end of the compact result file" << std::endl;
+	verbose && std::cerr << "Loaded " << recordOffsets.size() << " compact results" << std::endl;
+	return true;
+#endif
+}
+
+// stops at the first record that is incomplete or damaged, validSize is where the next record belongs
+bool CompactResultFile::readFile(uint64_t& validSize) {
+	const uint8_t* data = reinterpret_cast<const uint8_t*>(mapping);
+	if (mappingSize < FileHeaderSize || memcmp(data, FileMagic, sizeof(FileMagic)) != 0 ||
+		readLE32(data + 8) != FileVersion)
+		return false;
+	uint32_t platformCount = readLE32(data + 12);
+	size_t headerSize = readLE32(data + 16);
+	if (headerSize < FileHeaderSize || headerSize > mappingSize || headerSize % Alignment != 0 ||
+		mz_crc32(MZ_CRC32_INIT, data + FileHeaderSize, headerSize - FileHeaderSize) != readLE32(data + 20))
+		return false;
+
+	platforms.clear();
+	size_t offset = FileHeaderSize;
+	auto readString = [&](std::string& str) {
+		if (headerSize - offset < 4 || headerSize - offset - 4 < readLE32(data + offset))
+			return false;
+		str.assign(reinterpret_cast<const char*>(data + offset + 4), readLE32(data + offset));
+		offset += 4 + str.size();
+		return true;
+	};
+	for (uint32_t i = 0; i < platformCount; i++) {
+		Platform platform;
+		if (!readString(platform.name) || headerSize - offset < Sha256::DigestSize + 4)
+			return false;
+		memcpy(platform.signature, data + offset, Sha256::DigestSize);
+		uint32_t symbolCount = readLE32(data + offset + Sha256::DigestSize);
+		offset += Sha256::DigestSize + 4;
+		if (symbolCount > (headerSize - offset) / 4)
+			return false;
+		platform.functionNames.resize(symbolCount);
+		for (uint32_t j = 0; j < symbolCount; j++) {
+			if (!readString(platform.functionNames[j]))
+				return false;
+		}
+		platforms.push_back(platform);
+	}
+
+	recordOffsets.clear();
+	offset = headerSize;
+	while (mappingSize - offset >= RecordHeaderSize) {
+		const uint8_t* record = data + offset;
+		uint32_t payloadSize = readLE32(record + 4);
+		if (readLE32(record) != RecordMagic || payloadSize > mappingSize - offset - RecordHeaderSize ||
+			mz_crc32(MZ_CRC32_INIT, record + RecordHeaderSize, payloadSize) != readLE32(record + 8) ||
+			!parseRecord(record + RecordHeaderSize, payloadSize, readLE16(record + 12), readLE16(record + 14), platforms, nullptr))
+			break;
+		recordOffsets.push_back(offset);
+		offset += RecordHeaderSize + payloadSize;
+	}
+	validSize = offset;
+	return true;
+}
+
+uint32_t CompactResultFile::getPlatformCount() const {
+	return platforms.size();
+}
+
+const CompactResultFile::Platform& CompactResultFile::getPlatform(uint32_t index) const {
+	return platforms[index];
+}
+
+uint32_t CompactResultFile::getRecordCount() const {
+	return recordOffsets.size();
+}
+
+void CompactResultFile::getRecord(uint32_t index, Record& record) const {
+	const uint8_t* data = reinterpret_cast<const uint8_t*>(mapping) + recordOffsets[index];
+	record.binaries.clear();
+	record.errors.clear();
+	parseRecord(data + RecordHeaderSize, readLE32(data + 4), readLE16(data + 12), readLE16(data + 14), platforms, &record);
+}
@@ -0,0 +1,422 @@
+#include "pbw_api_info.h"
+
+#include <algorithm>
+#include <cstring>
+#include <errno.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+static constexpr uint32_t MaxReadSize = 1 << 30; // the length of a single read is only 32 bit
+
+struct CorpusReader::Request {
+	uint32_t index;
+	std::string path;
+	int fd;
+	uint64_t size, offset;
+	std::vector<uint8_t>* buffer;
+};
+
+#ifdef HAVE_IO_URING
+struct CorpusReader::Ring {
+	int fd;
+	void* sqPointer;
+	size_t sqSize;
+	void* cqPointer;
+	size_t cqSize;
+	io_uring_sqe* sqes;
+	size_t sqesSize;
+	unsigned* sqHead;
+	unsigned* sqTail;
+	unsigned* sqMask;
+	unsigned* sqArray;
+	unsigned sqEntries;
+	unsigned* cqHead;
+	unsigned* cqTail;
+	unsigned* cqMask;
+	io_uring_cqe* cqes;
+	unsigned toSubmit;
+
+	// the sqe is only visible to the kernel after pushSqe
+	io_uring_sqe* nextSqe() {
+		unsigned tail = *sqTail;
+		unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+		if (tail - head >= sqEntries)
+			return nullptr;
+		unsigned slot = tail & *sqMask;
+		sqArray[slot] = slot;
+		io_uring_sqe* sqe = &sqes[slot];
+		memset(sqe, 0, sizeof(io_uring_sqe));
+		return sqe;
+	}
+
+	void pushSqe() {
+		__atomic_store_n(sqTail, *sqTail + 1, __ATOMIC_RELEASE);
+		toSubmit++;
+	}
+};
+#else
+struct CorpusReader::Ring {
+};
+#endif
+
+BufferPool::BufferPool(size_t max) : maxBuffers(max) {
+}
+
+BufferPool::~BufferPool() {
+	for (auto itBuffer = buffers.begin(); itBuffer != buffers.end(); ++itBuffer)
+		delete *itBuffer;
+}
+
+std::vector<uint8_t>* BufferPool::acquire() {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (buffers.empty())
+		return new std::vector<uint8_t>();
+	std::vector<uint8_t>* buffer = buffers.back();
+	buffers.pop_back();
+	return buffer;
+}
+
+void BufferPool::release(std::vector<uint8_t>* buffer) {
+	if (buffer == nullptr)
+		return;
+	std::lock_guard<std::mutex> lock(mutex);
+	if (buffers.size() < maxBuffers) {
+		buffer->clear(); // keeps the capacity
+		buffers.push_back(buffer);
+	}
+	else
+		delete buffer;
+}
+
+CorpusReader::CorpusReader(Mode m, uint32_t depth, BufferPool& bufferPool, bool verb) :
+	mode(m), pool(bufferPool), verbose(verb), ring(nullptr), bytesRead(0) {
+	if (depth == 0)
+		depth = 1;
+	if (mode == Mode_Uring && !setupRing(depth)) {
+		verbose && std::cerr << "io_uring is not available, reading with pread" << std::endl;
+		mode = Mode_Pread;
+	}
+	if (mode == Mode_Uring) {
+		for (uint32_t i = 0; i < depth; i++) {
+			requests.push_back(new Request());
+			freeRequests.push_back(i);
+		}
+	}
+}
+
+CorpusReader::~CorpusReader() {
+	// reads that are still in flight would write into released buffers
+	File file;
+	while (next(file))
+		pool.release(file.buffer);
+	for (auto itRequest = requests.begin(); itRequest != requests.end(); ++itRequest)
+		delete *itRequest;
+	cleanRing();
+}
+
+CorpusReader::Mode CorpusReader::getMode() const {
+	return mode;
+}
+
+uint64_t CorpusReader::getBytesRead() const {
+	return bytesRead;
+}
+
+bool CorpusReader::canSubmit() const {
+	if (mode == Mode_Pread)
+		return completed.empty();
+	return !freeRequests.empty();
+}
+
+uint32_t CorpusReader::inFlight() const {
+	return static_cast<uint32_t>(requests.size() - freeRequests.size() + completed.size());
+}
+
+void CorpusReader::submit(uint32_t index, const std::string& path) {
+	if (mode == Mode_Pread) {
+		std::vector<uint8_t>* buffer = pool.acquire();
+		if (!readBlocking(path, *buffer)) {
+			pool.release(buffer);
+			buffer = nullptr;
+		}
+		else
+			bytesRead += buffer->size();
+		completed.push_back(File{ index, buffer });
+		return;
+	}
+
+	uint32_t requestIndex = freeRequests.back();
+	freeRequests.pop_back();
+	Request& request = *requests[requestIndex];
+	request.index = index;
+	request.path = path;
+	request.fd = -1;
+	request.size = 0;
+	request.offset = 0;
+	request.buffer = nullptr;
+	if (!submitOpen(requestIndex))
+		complete(requestIndex, false);
+}
+
+bool CorpusReader::readBlocking(const std::string& path, std::vector<uint8_t>& buffer) {
+#ifdef WIN32
+	FILE* fp = fopen(path.c_str(), "rb");
+	if (fp == nullptr)
+		return false;
+	bool success = _fseeki64(fp, 0, SEEK_END) == 0;
+	int64_t size = success ? _ftelli64(fp) : -1;
+	if (size < 0 || static_cast<uint64_t>(size) > SIZE_MAX || _fseeki64(fp, 0, SEEK_SET) != 0) {
+		fclose(fp);
+		return false;
+	}
+	buffer.resize(static_cast<size_t>(size));
+	buffer.resize(fread(buffer.data(), 1, buffer.size(), fp));
+	success = !ferror(fp);
+	fclose(fp);
+	return success;
+#else
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) != 0 || !S_ISREG(fileStat.st_mode) || static_cast<uint64_t>(fileStat.st_size) > SIZE_MAX) {
+		close(fd);
+		return false;
+	}
+	buffer.resize(static_cast<size_t>(fileStat.st_size));
+	size_t total = 0;
+	while (total < buffer.size()) {
+		ssize_t readSize = pread(fd, buffer.data() + total, buffer.size() - total, static_cast<off_t>(total));
+		if (readSize < 0 && errno == EINTR)
+			continue;
+		if (readSize < 0) {
+			close(fd);
+			return false;
+		}
+		if (readSize == 0) // the file got shorter
+			break;
+		total += readSize;
+	}
+	buffer.resize(total);
+	close(fd);
+	return true;
+#endif
+}
+
+bool CorpusReader::next(File& file) {
+	while (completed.empty()) {
+		if (inFlight() == 0)
+			return false;
+#ifdef HAVE_IO_URING
+		int result = static_cast<int>(syscall(__NR_io_uring_enter, ring->fd, ring->toSubmit, 1, IORING_ENTER_GETEVENTS, nullptr, 0));
+		if (result < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY))
+			continue;
+		if (result < 0) {
+			// the kernel may still own the buffers, they are given up instead of reused
+			verbose && std::cerr << "io_uring_enter failed: " << strerror(errno) << std::endl;
+			for (uint32_t i = 0; i < requests.size(); i++) {
+				if (std::find(freeRequests.begin(), freeRequests.end(), i) == freeRequests.end()) {
+					requests[i]->buffer = nullptr;
+					complete(i, false);
+				}
+			}
+			continue;
+		}
+		ring->toSubmit -= result;
+
+		unsigned head = *ring->cqHead;
+		unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++) {
+			io_uring_cqe& cqe = ring->cqes[head & *ring->cqMask];
+			handleCompletion(static_cast<uint32_t>(cqe.user_data), cqe.res);
+		}
+		__atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+#endif
+	}
+	file = completed.front();
+	completed.pop_front();
+	return true;
+}
+
+void CorpusReader::handleCompletion(uint32_t requestIndex, int32_t result) {
+#ifdef HAVE_IO_URING
+	Request& request = *requests[requestIndex];
+	if (request.fd < 0) { // openat finished
+		if (result < 0) {
+			complete(requestIndex, false);
+			return;
+		}
+		request.fd = result;
+		struct stat fileStat;
+		if (fstat(request.fd, &fileStat) != 0 || !S_ISREG(fileStat.st_mode) || static_cast<uint64_t>(fileStat.st_size) > SIZE_MAX) {
+			complete(requestIndex, false);
+			return;
+		}
+		request.size = static_cast<uint64_t>(fileStat.st_size);
+		request.buffer = pool.acquire();
+		request.buffer->resize(static_cast<size_t>(request.size));
+	}
+	else if (result == -EINTR || result == -EAGAIN) {
+		// the same read is submitted again
+	}
+	else if (result < 0) {
+		complete(requestIndex, false);
+		return;
+	}
+	else if (result == 0) { // the file got shorter
+		request.buffer->resize(static_cast<size_t>(request.offset));
+		complete(requestIndex, true);
+		return;
+	}
+	else
+		request.offset += result;
+
+	if (request.offset == request.size)
+		complete(requestIndex, true);
+	else if (!submitRead(requestIndex))
+		complete(requestIndex, false);
+#else
+	(void)requestIndex;
+	(void)result;
+#endif
+}
+
+void CorpusReader::complete(uint32_t requestIndex, bool success) {
+	Request& request = *requests[requestIndex];
+#ifndef WIN32
+	if (request.fd >= 0)
+		close(request.fd);
+#endif
+	request.fd = -1;
+	if (success)
+		bytesRead += request.offset;
+	else {
+		pool.release(request.buffer);
+		request.buffer = nullptr;
+	}
+	completed.push_back(File{ request.index, request.buffer });
+	request.buffer = nullptr;
+	freeRequests.push_back(requestIndex);
+}
+
+bool CorpusReader::submitOpen(uint32_t requestIndex) {
+#ifdef HAVE_IO_URING
+	io_uring_sqe* sqe = ring->nextSqe();
+	if (sqe == nullptr)
+		return false;
+	sqe->opcode = IORING_OP_OPENAT;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = reinterpret_cast<uint64_t>(requests[requestIndex]->path.c_str());
+	sqe->open_flags = O_RDONLY | O_CLOEXEC;
+	sqe->user_data = requestIndex;
+	ring->pushSqe();
+	return true;
+#else
+	(void)requestIndex;
+	return false;
+#endif
+}
+
+bool CorpusReader::submitRead(uint32_t requestIndex) {
+#ifdef HAVE_IO_URING
+	Request& request = *requests[requestIndex];
+	io_uring_sqe* sqe = ring->nextSqe();
+	if (sqe == nullptr)
+		return false;
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = request.fd;
+	sqe->addr = reinterpret_cast<uint64_t>(request.buffer->data() + request.offset);
+	sqe->len = static_cast<uint32_t>(std::min<uint64_t>(request.size - request.offset, MaxReadSize));
+	sqe->off = request.offset;
+	sqe->user_data = requestIndex;
+	ring->pushSqe();
+	return true;
+#else
+	(void)requestIndex;
+	return false;
+#endif
+}
+
+bool CorpusReader::setupRing(uint32_t depth) {
+#ifdef HAVE_IO_URING
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	int fd = static_cast<int>(syscall(__NR_io_uring_setup, depth, &params));
+	if (fd < 0)
+		return false;
+
+	// openat and read need linux 5.6, older kernels fail the probe or do not know the opcodes
+	size_t probeSize = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+	std::vector<uint8_t> probeBuffer(probeSize, 0);
+	io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(probeBuffer.data());
+	if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) < 0 ||
+		probe->last_op < IORING_OP_READ ||
+		!(probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED) ||
+		!(probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED)) {
+		close(fd);
+		return false;
+	}
+
+	ring = new Ring();
+	ring->fd = fd;
+	ring->toSubmit = 0;
+	ring->sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (singleMap)
+		ring->sqSize = ring->cqSize = std::max(ring->sqSize, ring->cqSize);
+	ring->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+
+	ring->sqPointer = mmap(nullptr, ring->sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	ring->cqPointer = singleMap ? ring->sqPointer :
+		mmap(nullptr, ring->cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	void* sqes = mmap(nullptr, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	ring->sqes = sqes == MAP_FAILED ? nullptr : reinterpret_cast<io_uring_sqe*>(sqes);
+	if (ring->sqPointer == MAP_FAILED || ring->cqPointer == MAP_FAILED || ring->sqes == nullptr) {
+		cleanRing();
+		return false;
+	}
+
+	uint8_t* sq = reinterpret_cast<uint8_t*>(ring->sqPointer);
+	uint8_t* cq = reinterpret_cast<uint8_t*>(ring->cqPointer);
+	ring->sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+	ring->sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+	ring->sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+	ring->sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+	ring->sqEntries = params.sq_entries;
+	ring->cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+	ring->cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+	ring->cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+	ring->cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+	return true;
+#else
+	(void)depth;
+	return false;
+#endif
+}
+
+void CorpusReader::cleanRing() {
+	if (ring == nullptr)
+		return;
+#ifdef HAVE_IO_URING
+	if (ring->sqes != nullptr)
+		munmap(ring->sqes, ring->sqesSize);
+	if (ring->cqPointer != MAP_FAILED && ring->cqPointer != ring->sqPointer)
+		munmap(ring->cqPointer, ring->cqSize);
+	if (ring->sqPointer != MAP_FAILED)
+		munmap(ring->sqPointer, ring->sqSize);
+	close(ring->fd);
+#endif
+	delete ring;
+	ring = nullptr;
+}
@@ -0,0 +1,197 @@
+#include "pbw_api_info.h"
+
+#include <algorithm>
+#include <errno.h>
+
+#ifndef WIN32
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+static constexpr size_t DirectoryBufferSize = 64 * 1024;
+
+#ifdef __linux__
+struct LinuxDirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[1];
+};
+#endif
+
+// the order of a depth-first walk with sorted entries: a path separator sorts before every character
+static bool walkOrder(const std::string& a, const std::string& b) {
+	size_t length = std::min(a.size(), b.size());
+	for (size_t i = 0; i < length; i++) {
+		unsigned char charA = a[i] == '/' ? 0 : static_cast<unsigned char>(a[i]);
+		unsigned char charB = b[i] == '/' ? 0 : static_cast<unsigned char>(b[i]);
+		if (charA != charB)
+			return charA < charB;
+	}
+	return a.size() < b.size();
+}
+
+DirectoryWalker::DirectoryWalker(uint32_t threads, bool verb) :
+	threadCount(threads), verbose(verb), activeThreads(0) {
+	if (threadCount == 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+}
+
+void DirectoryWalker::setFilters(const std::vector<std::string>& includePatterns, const std::vector<std::string>& excludePatterns) {
+	includes = includePatterns;
+	excludes = excludePatterns;
+}
+
+bool DirectoryWalker::isIncluded(const std::string& path) const {
+	if (includes.empty())
+		return path.size() > 4 && path.compare(path.size() - 4, 4, ".pbw") == 0;
+#ifndef WIN32
+	for (auto itPattern = includes.begin(); itPattern != includes.end(); ++itPattern) {
+		if (fnmatch(itPattern->c_str(), path.c_str(), 0) == 0)
+			return true;
+	}
+#endif
+	return false;
+}
+
+bool DirectoryWalker::isExcluded(const std::string& path) const {
+#ifndef WIN32
+	for (auto itPattern = excludes.begin(); itPattern != excludes.end(); ++itPattern) {
+		if (fnmatch(itPattern->c_str(), path.c_str(), 0) == 0)
+			return true;
+	}
+#else
+	(void)path;
+#endif
+	return false;
+}
+
+bool DirectoryWalker::walk(const std::string& directory, std::vector<std::string>& paths) {
+#ifdef WIN32
+	(void)directory;
+	(void)paths;
+	std::cerr << "Directory inputs are not supported on this platform" << std::endl;
+	return false;
+#else
+	int rootFd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (rootFd < 0) {
+		verbose && std::cerr << "Could not open directory \"" << directory << "\": " << strerror(errno) << std::endl;
+		return false;
+	}
+	close(rootFd);
+
+	root = directory[directory.length() - 1] == '/' ? directory : directory + "/";
+	found.clear();
+	pendingDirectories.assign(1, "");
+	activeThreads = 0;
+	std::vector<std::thread> threads;
+	for (uint32_t i = 0; i < threadCount; i++)
+		threads.emplace_back(&DirectoryWalker::run, this);
+	for (auto itThread = threads.begin(); itThread != threads.end(); ++itThread)
+		itThread->join();
+
+	std::sort(found.begin(), found.end(), walkOrder);
+	for (auto itFound = found.begin(); itFound != found.end(); ++itFound)
+		paths.push_back(root + *itFound);
+	verbose && std::cerr << "Found " << found.size() << " files in \"" << directory << "\"" << std::endl;
+	found.clear();
+	return true;
+#endif
+}
+
+// the walk is finished once no directory is left and no thread can find another one
+void DirectoryWalker::run() {
+	std::vector<std::string> directories, files;
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		workAvailable.wait(lock, [this]() { return !pendingDirectories.empty() || activeThreads == 0; });
+		if (pendingDirectories.empty())
+			break;
+		std::string directory = pendingDirectories.front();
+		pendingDirectories.pop_front();
+		activeThreads++;
+		lock.unlock();
+
+		directories.clear();
+		files.clear();
+		readDirectory(directory, directories, files);
+
+		lock.lock();
+		activeThreads--;
+		pendingDirectories.insert(pendingDirectories.end(), directories.begin(), directories.end());
+		found.insert(found.end(), files.begin(), files.end());
+		workAvailable.notify_all();
+	}
+}
+
+void DirectoryWalker::readDirectory(const std::string& directory, std::vector<std::string>& directories, std::vector<std::string>& files) {
+#ifndef WIN32
+	std::string path = directory.empty() ? root : root + directory;
+	int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		verbose && std::cerr << "Could not open directory \"" << path << "\": " << strerror(errno) << std::endl;
+		return;
+	}
+	std::string prefix = directory.empty() ? "" : directory + "/";
+
+	auto addEntry = [&](const char* name, unsigned char type) {
+		if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+			return;
+		// symbolic links and file systems without d_type need a look at the entry itself
+		if (type == DT_UNKNOWN || type == DT_LNK) {
+			struct stat entryStat;
+			if (fstatat(fd, name, &entryStat, 0) != 0)
+				return;
+			type = S_ISDIR(entryStat.st_mode) ? DT_DIR : S_ISREG(entryStat.st_mode) ? DT_REG : DT_UNKNOWN;
+		}
+		std::string entryPath = prefix + name;
+		if ((type != DT_DIR && type != DT_REG) || isExcluded(entryPath))
+			return;
+		if (type == DT_DIR)
+			directories.push_back(entryPath);
+		else if (isIncluded(entryPath))
+			files.push_back(entryPath);
+	};
+
+#ifdef __linux__
+	std::vector<char> buffer(DirectoryBufferSize);
+	while (true) {
+		long size = syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+		if (size < 0 && errno == EINTR)
+			continue;
+		if (size <= 0) {
+			if (size < 0)
+				verbose && std::cerr << "Could not read directory \"" << path << "\": " << strerror(errno) << std::endl;
+			break;
+		}
+		for (long offset = 0; offset < size; ) {
+			LinuxDirent64* entry = reinterpret_cast<LinuxDirent64*>(buffer.data() + offset);
+			addEntry(entry->d_name, entry->d_type);
+			offset += entry->d_reclen;
+		}
+	}
+	close(fd);
+#else
+	DIR* dir = fdopendir(fd);
+	if (dir == nullptr) {
+		close(fd);
+		return;
+	}
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != nullptr)
+		addEntry(entry->d_name, entry->d_type);
+	closedir(dir);
+#endif
+#else
+	(void)directory;
+	(void)directories;
+	(void)files;
+#endif
+}
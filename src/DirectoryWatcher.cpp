@@ -0,0 +1,197 @@
+#include "pbw_api_info.h"
+
+#include <algorithm>
+#include <errno.h>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#endif
+
+static constexpr size_t EventBufferSize = 64 * 1024;
+
+static bool isAppArchiveName(const char* name) {
+	size_t len = strlen(name);
+	return len >= 4 && strcmp(name + len - 4, ".pbw") == 0;
+}
+
+DirectoryWatcher::DirectoryWatcher(uint32_t debounceMilliseconds, bool verb) :
+	fd(-1), debounce(debounceMilliseconds), verbose(verb) {
+#ifdef __linux__
+	fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+	if (fd < 0)
+		verbose && std::cerr << "Could not initialize inotify: " << strerror(errno) << std::endl;
+#endif
+}
+
+DirectoryWatcher::~DirectoryWatcher() {
+#ifdef __linux__
+	if (fd >= 0)
+		close(fd);
+#endif
+}
+
+bool DirectoryWatcher::watch(const std::string& path) {
+#ifdef __linux__
+	if (fd < 0)
+		return false;
+	std::string directory = path;
+	while (directory.size() > 1 && directory.back() == '/')
+		directory.pop_back();
+
+	// writes, renames into and out of the directory and the removal of the directory itself
+	uint32_t mask = IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_DELETE_SELF | IN_ONLYDIR;
+	int wd = inotify_add_watch(fd, directory.c_str(), mask);
+	if (wd < 0) {
+		verbose && std::cerr << "Could not watch \"" << directory << "\": " << strerror(errno) << std::endl;
+		return false;
+	}
+	directories[wd] = directory;
+	verbose && std::cerr << "Watching \"" << directory << "\"" << std::endl;
+
+	DIR* dir = opendir(directory.c_str());
+	if (dir == nullptr)
+		return true;
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != nullptr) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+			continue;
+		std::string entryPath = directory + "/" + entry->d_name;
+		// lstat does not follow symlinks, a link back to a parent directory would recurse forever
+		struct stat entryStat;
+		if (lstat(entryPath.c_str(), &entryStat) == 0 && S_ISDIR(entryStat.st_mode))
+			watch(entryPath);
+	}
+	closedir(dir);
+	return true;
+#else
+	(void)path;
+	return false;
+#endif
+}
+
+// new directories are watched and their pbws are picked up as if they were just written
+void DirectoryWatcher::handleEvent(int wd, uint32_t mask, const char* name) {
+#ifdef __linux__
+	auto itDirectory = directories.find(wd);
+	if (itDirectory == directories.end())
+		return;
+	if (mask & (IN_DELETE_SELF | IN_IGNORED)) {
+		directories.erase(itDirectory);
+		return;
+	}
+	if (name == nullptr || name[0] == '\0')
+		return;
+
+	std::string path = itDirectory->second + "/" + name;
+	if (mask & IN_ISDIR) {
+		if ((mask & (IN_CREATE | IN_MOVED_TO)) && watch(path)) {
+			std::vector<std::string> archives;
+			collectArchives(path, archives);
+			for (auto itArchive = archives.begin(); itArchive != archives.end(); ++itArchive)
+				pending[*itArchive] = std::chrono::steady_clock::now() + std::chrono::milliseconds(debounce);
+		}
+		return;
+	}
+	if (!isAppArchiveName(name))
+		return;
+
+	if (mask & (IN_DELETE | IN_MOVED_FROM))
+		pending.erase(path);
+	else // every write pushes the deadline back, the file is only scanned once it is quiet
+		pending[path] = std::chrono::steady_clock::now() + std::chrono::milliseconds(debounce);
+#else
+	(void)wd;
+	(void)mask;
+	(void)name;
+#endif
+}
+
+void DirectoryWatcher::collectArchives(const std::string& directory, std::vector<std::string>& archives) {
+#ifdef __linux__
+	DIR* dir = opendir(directory.c_str());
+	if (dir == nullptr)
+		return;
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != nullptr) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+			continue;
+		std::string entryPath = directory + "/" + entry->d_name;
+		// symlinked directories are not entered, just like watch() skips them, links to pbws are fine
+		struct stat entryStat;
+		if (lstat(entryPath.c_str(), &entryStat) != 0)
+			continue;
+		if (S_ISDIR(entryStat.st_mode))
+			collectArchives(entryPath, archives);
+		else if (S_ISLNK(entryStat.st_mode) && isAppArchiveName(entry->d_name) && stat(entryPath.c_str(), &entryStat) == 0 && S_ISREG(entryStat.st_mode))
+			archives.push_back(entryPath);
+		else if (S_ISREG(entryStat.st_mode) && isAppArchiveName(entry->d_name))
+			archives.push_back(entryPath);
+	}
+	closedir(dir);
+#else
+	(void)directory;
+	(void)archives;
+#endif
+}
+
+bool DirectoryWatcher::wait(std::vector<std::string>& readyFiles, int timeoutMilliseconds) {
+#ifdef __linux__
+	if (fd < 0)
+		return false;
+
+	// wake up for the next file that becomes quiet, or for new events
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	int timeout = timeoutMilliseconds;
+	for (auto itPending = pending.begin(); itPending != pending.end(); ++itPending) {
+		int untilReady = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(itPending->second - now).count()) + 1;
+		untilReady = std::max(untilReady, 0);
+		if (timeout < 0 || untilReady < timeout)
+			timeout = untilReady;
+	}
+
+	pollfd pollFd;
+	pollFd.fd = fd;
+	pollFd.events = POLLIN;
+	int result = poll(&pollFd, 1, timeout);
+	if (result < 0 && errno != EINTR) {
+		verbose && std::cerr << "Could not wait for inotify events: " << strerror(errno) << std::endl;
+		return false;
+	}
+
+	if (result > 0) {
+		alignas(inotify_event) char buffer[EventBufferSize];
+		while (true) {
+			ssize_t size = read(fd, buffer, sizeof(buffer));
+			if (size <= 0)
+				break;
+			for (char* cur = buffer; cur < buffer + size; ) {
+				inotify_event* event = reinterpret_cast<inotify_event*>(cur);
+				if (event->mask & IN_Q_OVERFLOW)
+					verbose && std::cerr << "Too many inotify events, some changes were missed" << std::endl;
+				else
+					handleEvent(event->wd, event->mask, event->len > 0 ? event->name : nullptr);
+				cur += sizeof(inotify_event) + event->len;
+			}
+		}
+	}
+
+	now = std::chrono::steady_clock::now();
+	for (auto itPending = pending.begin(); itPending != pending.end(); ) {
+		if (itPending->second <= now) {
+			readyFiles.push_back(itPending->first);
+			itPending = pending.erase(itPending);
+		}
+		else
+			++itPending;
+	}
+	return true;
+#else
+	(void)readyFiles;
+	(void)timeoutMilliseconds;
+	return false;
+#endif
+}
@@ -0,0 +1,94 @@
+#include "pbw_api_info.h"
+
+#include <algorithm>
+
+FunctionMap::FunctionMap() : libraryNames(nullptr) {
+}
+
+uint32_t FunctionMap::internName(const std::string& name) {
+	auto inserted = nameIds.emplace(name, static_cast<uint32_t>(names.size()));
+	if (inserted.second)
+		names.push_back(name);
+	return inserted.first->second;
+}
+
+void FunctionMap::reserve(uint32_t symbolTableSize, size_t nameCount) {
+	names.reserve(nameCount);
+	nameIds.reserve(nameCount);
+	entries.reserve(nameCount);
+	if (symbolTableSize + 1 > offsetStart.size())
+		offsetStart.resize(symbolTableSize + 1, 0);
+}
+
+void FunctionMap::addEntry(uint32_t symbolTableOffset, uint32_t nameId) {
+	entries.push_back((static_cast<uint64_t>(symbolTableOffset) << 32) | nameId);
+	// offsetStart has one more element than the symbol table, it never shrinks
+	if (symbolTableOffset + 1 >= offsetStart.size())
+		offsetStart.resize(symbolTableOffset + 2, 0);
+}
+
+void FunctionMap::add(uint32_t symbolTableOffset, const std::string& name) {
+	addEntry(symbolTableOffset, internName(name));
+}
+
+// libraries sharing a string pool only have their names hashed once
+void FunctionMap::addLibrary(const PblLibrary& library) {
+	if (libraryNames != &library.getFunctionNames()) {
+		libraryNames = &library.getFunctionNames();
+		libraryNameIds.clear();
+	}
+	libraryNameIds.resize(libraryNames->getCount(), UINT32_MAX);
+	for (uint32_t i = 0; i < library.getFunctionCount(); i++) {
+		uint32_t symbolTableOffset = library.getFunctionSymbolTableOffset(i);
+		if (symbolTableOffset == UINT32_MAX)
+			continue;
+		uint32_t& nameId = libraryNameIds[library.getFunctionNameId(i)];
+		if (nameId == UINT32_MAX)
+			nameId = internName(library.getFunctionName(i));
+		addEntry(symbolTableOffset, nameId);
+	}
+}
+
+// a counting sort keeps the order the names were added within an offset, the few names of an offset are compared by id
+void FunctionMap::finish() {
+	std::fill(offsetStart.begin(), offsetStart.end(), 0);
+	for (auto itEntry = entries.begin(); itEntry != entries.end(); ++itEntry)
+		offsetStart[(*itEntry >> 32) + 1]++;
+	for (uint32_t i = 1; i < offsetStart.size(); i++)
+		offsetStart[i] += offsetStart[i - 1];
+
+	std::vector<uint32_t> offsetEnd(offsetStart.begin(), offsetStart.end() - (offsetStart.empty() ? 0 : 1));
+	offsetNames.assign(entries.size(), 0);
+	for (auto itEntry = entries.begin(); itEntry != entries.end(); ++itEntry) {
+		uint32_t symbolTableOffset = static_cast<uint32_t>(*itEntry >> 32);
+		uint32_t nameId = static_cast<uint32_t>(*itEntry & UINT32_MAX);
+		uint32_t begin = offsetStart[symbolTableOffset];
+		uint32_t& end = offsetEnd[symbolTableOffset];
+		if (std::find(offsetNames.begin() + begin, offsetNames.begin() + end, nameId) == offsetNames.begin() + end)
+			offsetNames[end++] = nameId;
+	}
+
+	// closes the gaps the duplicates left
+	uint32_t size = 0;
+	for (uint32_t i = 0; i + 1 < offsetStart.size(); i++) {
+		uint32_t begin = offsetStart[i];
+		offsetStart[i] = size;
+		for (uint32_t j = begin; j < offsetEnd[i]; j++)
+			offsetNames[size++] = offsetNames[j];
+	}
+	if (!offsetStart.empty())
+		offsetStart.back() = size;
+	offsetNames.resize(size);
+}
+
+uint32_t FunctionMap::getSymbolTableSize() const {
+	return offsetStart.empty() ? 0 : static_cast<uint32_t>(offsetStart.size() - 1);
+}
+
+uint32_t FunctionMap::getNameCount(uint32_t symbolTableOffset) const {
+	return offsetStart[symbolTableOffset + 1] - offsetStart[symbolTableOffset];
+}
+
+const std::string& FunctionMap::getName(uint32_t symbolTableOffset, uint32_t index) const {
+	return names[offsetNames[offsetStart[symbolTableOffset] + index]];
+}
@@ -0,0 +1,116 @@
+#include "pbw_api_info.h"
+
+#include <errno.h>
+#ifdef WIN32
+#include <io.h>
+static int writeFile(int fd, const void* data, size_t size) { return _write(fd, data, static_cast<unsigned int>(size)); }
+#else
+#include <unistd.h>
+static ssize_t writeFile(int fd, const void* data, size_t size) { return ::write(fd, data, size); }
+#endif
+
+static constexpr size_t BlockSize = 1024 * 1024; // uncompressed bytes of a gzip member
+static constexpr uint32_t BlocksPerThread = 2; // blocks waiting or being compressed before write has to wait
+static constexpr uint8_t GzipHeader[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 255 }; // deflate, no name, no time, unknown os
+
+static void appendLE32(std::string& data, uint32_t value) {
+	for (int i = 0; i < 4; i++)
+		data.push_back(static_cast<char>((value >> (i * 8)) & 0xff));
+}
+
+static bool writeAll(int fd, const std::string& data) {
+	size_t offset = 0;
+	while (offset < data.size()) {
+		auto written = writeFile(fd, data.data() + offset, data.size() - offset);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return false;
+		offset += written;
+	}
+	return true;
+}
+
+GzipStream::GzipStream(int fd, int level, uint32_t threads) :
+	fileDescriptor(fd), compressionFlags(tdefl_create_comp_flags_from_zip_params(level, -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY)),
+	nextBlock(0), nextWrite(0), blocksInFlight(0), failed(false), pool(threads) {
+	block.reserve(BlockSize);
+}
+
+GzipStream::~GzipStream() {
+	// an empty file is no gzip file, it needs at least one member
+	if (nextBlock == 0)
+		submitBlock(true);
+	flush();
+}
+
+bool GzipStream::write(const void* data, size_t size) {
+	const char* cur = reinterpret_cast<const char*>(data);
+	while (size > 0) {
+		size_t part = std::min(size, BlockSize - block.size());
+		block.append(cur, part);
+		cur += part;
+		size -= part;
+		if (block.size() == BlockSize)
+			submitBlock(false);
+	}
+	return !failed;
+}
+
+bool GzipStream::flush() {
+	submitBlock(false);
+	pool.wait();
+	return !failed;
+}
+
+bool GzipStream::good() const {
+	return !failed;
+}
+
+// an empty block is only submitted if forced
+void GzipStream::submitBlock(bool force) {
+	if (block.empty() && !force)
+		return;
+	std::string* data = new std::string();
+	data->swap(block);
+	block.reserve(BlockSize);
+	uint64_t sequence = nextBlock++;
+	{
+		// the compressed members wait for the slowest one, without a limit they could pile up
+		std::unique_lock<std::mutex> lock(mutex);
+		blockWritten.wait(lock, [this]() { return blocksInFlight < BlocksPerThread * pool.getThreadCount(); });
+		blocksInFlight++;
+	}
+	pool.submit([this, sequence, data]() {
+		compressBlock(sequence, data);
+	});
+}
+
+void GzipStream::compressBlock(uint64_t sequence, std::string* data) {
+	size_t compressedSize = 0;
+	void* compressedData = tdefl_compress_mem_to_heap(data->data(), data->size(), &compressedSize, compressionFlags);
+	std::string member;
+	if (compressedData != nullptr) {
+		member.reserve(sizeof(GzipHeader) + compressedSize + 8);
+		member.append(reinterpret_cast<const char*>(GzipHeader), sizeof(GzipHeader));
+		member.append(reinterpret_cast<const char*>(compressedData), compressedSize);
+		appendLE32(member, static_cast<uint32_t>(mz_crc32(MZ_CRC32_INIT, reinterpret_cast<const uint8_t*>(data->data()), data->size())));
+		appendLE32(member, static_cast<uint32_t>(data->size()));
+		mz_free(compressedData);
+	}
+	else
+		failed = true;
+	delete data;
+
+	// the members are written in order by whichever thread finishes the next one
+	std::lock_guard<std::mutex> lock(mutex);
+	compressed[sequence].swap(member);
+	while (!compressed.empty() && compressed.begin()->first == nextWrite) {
+		if (!failed && !writeAll(fileDescriptor, compressed.begin()->second))
+			failed = true;
+		compressed.erase(compressed.begin());
+		nextWrite++;
+		blocksInFlight--;
+	}
+	blockWritten.notify_all();
+}
@@ -0,0 +1,62 @@
+#include "pbw_api_info.h"
+
+InputBudget::InputBudget() : inflatedSize(0), scanBytes(0), exceeded(Limit_None) {
+}
+
+void InputBudget::start(const Limits& budgetLimits) {
+	limits = budgetLimits;
+	deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(limits.milliseconds);
+	inflatedSize = 0;
+	scanBytes = 0;
+	exceeded = Limit_None;
+}
+
+// the first limit that was exceeded is the one reported
+bool InputBudget::exceed(Limit limit) {
+	int none = Limit_None;
+	exceeded.compare_exchange_strong(none, limit);
+	return false;
+}
+
+bool InputBudget::reserveInflate(uint64_t size) {
+	if (isExceeded())
+		return false;
+	uint64_t total = inflatedSize += size;
+	if (limits.inflatedSize > 0 && total > limits.inflatedSize)
+		return exceed(Limit_InflatedSize);
+	return checkTime();
+}
+
+bool InputBudget::chargeScan(uint64_t size) {
+	if (isExceeded())
+		return false;
+	uint64_t total = scanBytes += size;
+	if (limits.scanBytes > 0 && total > limits.scanBytes)
+		return exceed(Limit_ScanBytes);
+	return checkTime();
+}
+
+bool InputBudget::checkTime() {
+	if (isExceeded())
+		return false;
+	if (limits.milliseconds > 0 && std::chrono::steady_clock::now() > deadline)
+		return exceed(Limit_Time);
+	return true;
+}
+
+bool InputBudget::isExceeded() const {
+	return exceeded.load() != Limit_None;
+}
+
+std::string InputBudget::getError() const {
+	switch (exceeded.load()) {
+	case Limit_InflatedSize:
+		return "Budget exceeded: binaries larger than " + std::to_string(limits.inflatedSize) + " bytes";
+	case Limit_Time:
+		return "Budget exceeded: took longer than " + std::to_string(limits.milliseconds) + " ms";
+	case Limit_ScanBytes:
+		return "Budget exceeded: scanned more than " + std::to_string(limits.scanBytes) + " bytes";
+	default:
+		return "";
+	}
+}
@@ -0,0 +1,147 @@
+#include "pbw_api_info.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#ifdef WIN32
+#include <io.h>
+#define STDOUT_FILENO 1
+static int openFile(const char* path, bool binary) { return _open(path, _O_WRONLY | _O_CREAT | _O_TRUNC | (binary ? _O_BINARY : _O_TEXT), 0666); }
+static int writeFile(int fd, const void* data, size_t size) { return _write(fd, data, static_cast<unsigned int>(size)); }
+static void closeFile(int fd) { _close(fd); }
+#else
+#include <unistd.h>
+static int openFile(const char* path, bool) { return ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666); }
+static ssize_t writeFile(int fd, const void* data, size_t size) { return ::write(fd, data, size); }
+static void closeFile(int fd) { ::close(fd); }
+#endif
+
+static constexpr size_t BufferSize = 256 * 1024; // written as soon as it is full
+
+JsonWriter::JsonWriter() : fileDescriptor(-1), ownsFile(false), failed(false), gzip(nullptr) {
+}
+
+JsonWriter::~JsonWriter() {
+	flush();
+	delete gzip;
+	if (ownsFile)
+		closeFile(fileDescriptor);
+}
+
+bool JsonWriter::open(const std::string& path, int compressionLevel, uint32_t threads) {
+	buffer.reserve(BufferSize + BufferSize / 4);
+	if (path == "")
+		fileDescriptor = STDOUT_FILENO;
+	else {
+		fileDescriptor = openFile(path.c_str(), compressionLevel >= 0);
+		ownsFile = fileDescriptor >= 0;
+		failed = !ownsFile;
+	}
+#ifdef WIN32
+	if (path == "" && compressionLevel >= 0)
+		_setmode(STDOUT_FILENO, _O_BINARY);
+#endif
+	if (!failed && compressionLevel >= 0)
+		gzip = new GzipStream(fileDescriptor, compressionLevel, threads);
+	return !failed;
+}
+
+void JsonWriter::writeBuffer() {
+	if (gzip != nullptr) {
+		if (!gzip->write(buffer.data(), buffer.size()))
+			failed = true;
+		buffer.clear();
+		return;
+	}
+	size_t offset = 0;
+	while (!failed && offset < buffer.size()) {
+		auto written = writeFile(fileDescriptor, buffer.data() + offset, buffer.size() - offset);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			failed = true;
+		else
+			offset += written;
+	}
+	buffer.clear(); // keeps the capacity
+}
+
+JsonWriter& JsonWriter::operator<<(char c) {
+	buffer.push_back(c);
+	if (fileDescriptor >= 0 && buffer.size() >= BufferSize)
+		writeBuffer();
+	return *this;
+}
+
+JsonWriter& JsonWriter::operator<<(const char* str) {
+	buffer.append(str);
+	if (fileDescriptor >= 0 && buffer.size() >= BufferSize)
+		writeBuffer();
+	return *this;
+}
+
+JsonWriter& JsonWriter::operator<<(const std::string& str) {
+	buffer.append(str);
+	if (fileDescriptor >= 0 && buffer.size() >= BufferSize)
+		writeBuffer();
+	return *this;
+}
+
+JsonWriter& JsonWriter::operator<<(uint32_t value) {
+	char digits[10];
+	int count = 0;
+	do {
+		digits[count++] = static_cast<char>('0' + value % 10);
+		value /= 10;
+	} while (value > 0);
+	while (count > 0)
+		buffer.push_back(digits[--count]);
+	if (fileDescriptor >= 0 && buffer.size() >= BufferSize)
+		writeBuffer();
+	return *this;
+}
+
+void JsonWriter::writeRepeated(char c, uint32_t count) {
+	buffer.append(count, c);
+}
+
+void JsonWriter::appendString(std::string& out, const char* str, size_t length) {
+	static const char* hexDigits = "0123456789abcdef";
+	out.push_back('"');
+	for (size_t i = 0; i < length; i++) {
+		unsigned char c = static_cast<unsigned char>(str[i]);
+		if (c == '"' || c == '\\') {
+			out.push_back('\\');
+			out.push_back(static_cast<char>(c));
+		}
+		else if (c < 0x20) {
+			out.append("\\u00");
+			out.push_back(hexDigits[c >> 4]);
+			out.push_back(hexDigits[c & 0xf]);
+		}
+		else
+			out.push_back(static_cast<char>(c));
+	}
+	out.push_back('"');
+}
+
+void JsonWriter::writeString(const std::string& str) {
+	appendString(buffer, str.data(), str.size());
+	if (fileDescriptor >= 0 && buffer.size() >= BufferSize)
+		writeBuffer();
+}
+
+bool JsonWriter::flush() {
+	if (fileDescriptor >= 0)
+		writeBuffer();
+	if (gzip != nullptr && !gzip->flush())
+		failed = true;
+	return !failed;
+}
+
+bool JsonWriter::good() const {
+	return !failed;
+}
+
+const std::string& JsonWriter::str() const {
+	return buffer;
+}
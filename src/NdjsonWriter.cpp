@@ -0,0 +1,100 @@
+#include "pbw_api_info.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#ifdef WIN32
+#include <io.h>
+#define STDOUT_FILENO 1
+static int openFile(const char* path) { return _open(path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_APPEND | _O_BINARY, 0644); }
+static int writeFile(int fd, const void* data, size_t size) { return _write(fd, data, static_cast<unsigned int>(size)); }
+static void closeFile(int fd) { _close(fd); }
+#else
+#include <unistd.h>
+static int openFile(const char* path) { return ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644); }
+static ssize_t writeFile(int fd, const void* data, size_t size) { return ::write(fd, data, size); }
+static void closeFile(int fd) { ::close(fd); }
+#endif
+
+NdjsonWriter::NdjsonWriter() : fileDescriptor(-1), ownsFile(false), gzip(nullptr) {
+}
+
+NdjsonWriter::~NdjsonWriter() {
+	delete gzip;
+	if (ownsFile)
+		closeFile(fileDescriptor);
+}
+
+bool NdjsonWriter::open(const std::string& path, int compressionLevel, uint32_t threads) {
+	if (path == "")
+		fileDescriptor = STDOUT_FILENO;
+	else {
+		fileDescriptor = openFile(path.c_str());
+		ownsFile = fileDescriptor >= 0;
+		if (!ownsFile)
+			return false;
+	}
+#ifdef WIN32
+	if (path == "" && compressionLevel >= 0)
+		_setmode(STDOUT_FILENO, _O_BINARY);
+#endif
+	if (compressionLevel >= 0)
+		gzip = new GzipStream(fileDescriptor, compressionLevel, threads);
+	return true;
+}
+
+bool NdjsonWriter::flush() {
+	std::lock_guard<std::mutex> lock(writeMutex);
+	return gzip == nullptr || gzip->flush();
+}
+
+void NdjsonWriter::serialize(std::string& record, const std::string& input, const BatchScanner::AppResult& result, bool asSymbolOffset) {
+	record.clear();
+	record += "{\"input\":";
+	JsonWriter::appendString(record, input.data(), input.size());
+
+	record += ",\"platforms\":{";
+	for (uint32_t i = 0; i < result.binaries.size(); i++) {
+		const PblAppBinary* binary = result.binaries[i];
+		if (i > 0)
+			record += ',';
+		const char* platformName = binary->getPlatformName();
+		JsonWriter::appendString(record, platformName, strlen(platformName));
+		record += ":{\"usedAPIs\":[";
+		for (uint32_t j = 0; j < binary->getUsedFunctionCount(); j++) {
+			if (j > 0)
+				record += ',';
+			if (asSymbolOffset)
+				record += std::to_string(binary->getUsedFunctionSymbolTableOffset(j));
+			else {
+				const char* functionName = binary->getUsedFunctionName(j);
+				JsonWriter::appendString(record, functionName, strlen(functionName));
+			}
+		}
+		record += "]}";
+	}
+
+	record += "},\"errors\":[";
+	for (uint32_t i = 0; i < result.errors.size(); i++) {
+		if (i > 0)
+			record += ',';
+		JsonWriter::appendString(record, result.errors[i].data(), result.errors[i].size());
+	}
+	record += "]}\n";
+}
+
+bool NdjsonWriter::write(const std::string& record) {
+	// the lock keeps records whole on pipes, where large writes are not atomic
+	std::lock_guard<std::mutex> lock(writeMutex);
+	if (gzip != nullptr)
+		return gzip->write(record.data(), record.size());
+	size_t offset = 0;
+	while (offset < record.size()) {
+		auto written = writeFile(fileDescriptor, record.data() + offset, record.size() - offset);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return false;
+		offset += written;
+	}
+	return true;
+}
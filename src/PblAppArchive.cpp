@@ -1,5 +1,29 @@
 #include "pbw_api_info.h"
 
+#include <algorithm>
+#include <errno.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+static constexpr uint32_t LocalHeaderSignature = 0x04034b50;
+static constexpr uint32_t LocalHeaderSize = 30;
+static constexpr uint32_t LocalHeaderFileNameLenOffset = 26;
+static constexpr uint32_t LocalHeaderExtraLenOffset = 28;
+static constexpr size_t InflateReadBufferSize = 64 * 1024;
+static constexpr size_t PartialInflateReadBufferSize = 4 * 1024;
+
+static uint32_t readLE16(const uint8_t* p) {
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t readLE32(const uint8_t* p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
 void* minizip_alloc(void* d, size_t items, size_t size) {
 	return malloc(items * size);
 }
@@ -17,18 +41,86 @@ PblAppArchive::PblAppArchive() {
 	archive.m_pAlloc = minizip_alloc;
 	archive.m_pFree = minizip_free;
 	archive.m_pRealloc = minizip_realloc;
+	archive.m_pRead = readArchive;
+	archive.m_pIO_opaque = this;
+	hasAppInfo = false;
+#ifdef WIN32
+	file = nullptr;
+#else
+	fileDescriptor = -1;
+#endif
 }
 
 PblAppArchive::~PblAppArchive() {
 	mz_zip_reader_end(&archive);
+#ifdef WIN32
+	if (file != nullptr)
+		fclose(file);
+#else
+	if (fileDescriptor >= 0)
+		close(fileDescriptor);
+#endif
+}
+
+// reads at an absolute offset and never relies on a shared file position
+size_t PblAppArchive::readArchive(void* opaque, mz_uint64 offset, void* buffer, size_t size) {
+	PblAppArchive* self = reinterpret_cast<PblAppArchive*>(opaque);
+#ifdef WIN32
+	std::lock_guard<std::mutex> lock(self->fileMutex);
+	if (_fseeki64(self->file, static_cast<int64_t>(offset), SEEK_SET) != 0)
+		return 0;
+	return fread(buffer, 1, size, self->file);
+#else
+	size_t total = 0;
+	while (total < size) {
+		ssize_t readSize = pread(self->fileDescriptor, reinterpret_cast<uint8_t*>(buffer) + total,
+			size - total, static_cast<off_t>(offset + total));
+		if (readSize < 0 && errno == EINTR)
+			continue;
+		if (readSize <= 0)
+			break;
+		total += readSize;
+	}
+	return total;
+#endif
 }
 
 bool PblAppArchive::load(const char* filename, bool verbose) {
-	if (!mz_zip_reader_init_file(&archive, filename, 0)) {
+	uint64_t fileSize;
+#ifdef WIN32
+	file = fopen(filename, "rb");
+	if (file != nullptr) {
+		_fseeki64(file, 0, SEEK_END);
+		fileSize = _ftelli64(file);
+	}
+	if (file == nullptr) {
+#else
+	struct stat s;
+	fileDescriptor = open(filename, O_RDONLY);
+	if (fileDescriptor >= 0 && fstat(fileDescriptor, &s) == 0)
+		fileSize = s.st_size;
+	else {
+#endif
+		verbose && std::cerr << "Could not open pebble app archive: " << mz_zip_get_error_string(MZ_ZIP_FILE_OPEN_FAILED) << std::endl;
+		return false;
+	}
+
+	if (!mz_zip_reader_init(&archive, fileSize, 0)) {
 		verbose && std::cerr << "Could not open pebble app archive: " << mz_zip_get_error_string(mz_zip_get_last_error(&archive)) << std::endl;
 		return false;
 	}
+	return findFiles(verbose);
+}
+
+bool PblAppArchive::loadFromMemory(const void* data, size_t size, bool verbose) {
+	if (!mz_zip_reader_init_mem(&archive, data, size, 0)) {
+		verbose && std::cerr << "Could not open pebble app archive: " << mz_zip_get_error_string(mz_zip_get_last_error(&archive)) << std::endl;
+		return false;
+	}
+	return findFiles(verbose);
+}
 
+bool PblAppArchive::findFiles(bool verbose) {
 	// find all files named <platform>/pebble-app.bin
 	uint32_t fileCount = mz_zip_reader_get_num_files(&archive);
 	for (uint32_t i = 0; i < fileCount; i++) {
@@ -36,6 +128,12 @@ bool PblAppArchive::load(const char* filename, bool verbose) {
 		std::string name;
 		name.resize(mz_zip_reader_get_filename(&archive, i, nullptr, 0));
 		mz_zip_reader_get_filename(&archive, i, &name[0], name.length());
+		name.resize(strlen(name.c_str()));
+
+		if (name == "appinfo.json") {
+			hasAppInfo = statFile(i, appInfo);
+			continue;
+		}
 
 		size_t posApp = name.find("pebble-app.bin");
 		if (posApp == std::string::npos)
@@ -45,7 +143,11 @@ bool PblAppArchive::load(const char* filename, bool verbose) {
 			info.platform = "aplite";
 		else
 			info.platform = name.substr(0, slashPos);
-		info.fileIndex = i;
+
+		if (!statFile(i, info.file)) {
+			verbose && std::cerr << "Unsupported binary for " << info.platform << std::endl;
+			continue;
+		}
 
 		verbose && std::cerr << "Found binary for " << info.platform << std::endl;
 		binaries.push_back(info);
@@ -54,6 +156,20 @@ bool PblAppArchive::load(const char* filename, bool verbose) {
 	return binaries.size() > 0;
 }
 
+// keeps everything extraction needs, so it never has to touch the central directory again
+bool PblAppArchive::statFile(uint32_t fileIndex, FileInfo& info) {
+	mz_zip_archive_file_stat stat;
+	if (!mz_zip_reader_file_stat(&archive, fileIndex, &stat) || !stat.m_is_supported)
+		return false;
+	info.fileIndex = fileIndex;
+	info.localHeaderOffset = stat.m_local_header_ofs;
+	info.compressedSize = stat.m_comp_size;
+	info.uncompressedSize = stat.m_uncomp_size;
+	info.method = stat.m_method;
+	info.crc32 = stat.m_crc32;
+	return true;
+}
+
 uint32_t PblAppArchive::getBinaryCount() const {
 	return binaries.size();
 }
@@ -65,15 +181,146 @@ const char* PblAppArchive::getBinaryPlatform(uint32_t index) const {
 		return binaries[index].platform.c_str();
 }
 
-void* PblAppArchive::extractBinary(uint32_t index, uint32_t* size, bool verbose) {
+/**
+ * inflates a file into output, all state is local to the call
+ * (in contrast to mz_zip_reader_extract_* which report through the shared archive)
+ */
+// the hasher sees every byte right after it was inflated, while it is still in the cache
+// with a budget inflation is cancelled between two chunks once the input ran out of time
+mz_zip_error PblAppArchive::inflateFile(const FileInfo& info, uint8_t* output, size_t outputSize, Sha256* hasher, InputBudget* budget) const {
+	if (outputSize > info.uncompressedSize)
+		return MZ_ZIP_BUF_TOO_SMALL;
+	bool partial = outputSize < info.uncompressedSize;
+
+	// the local header may have a different extra field than the central directory
+	uint8_t localHeader[LocalHeaderSize];
+	if (archive.m_pRead(archive.m_pIO_opaque, info.localHeaderOffset, localHeader, LocalHeaderSize) != LocalHeaderSize)
+		return MZ_ZIP_FILE_READ_FAILED;
+	if (readLE32(localHeader) != LocalHeaderSignature)
+		return MZ_ZIP_INVALID_HEADER_OR_CORRUPTED;
+	uint64_t dataOffset = info.localHeaderOffset + LocalHeaderSize +
+		readLE16(localHeader + LocalHeaderFileNameLenOffset) +
+		readLE16(localHeader + LocalHeaderExtraLenOffset);
+	if (dataOffset + info.compressedSize > archive.m_archive_size)
+		return MZ_ZIP_INVALID_HEADER_OR_CORRUPTED;
+
+	// stored
+	if (info.method == 0) {
+		if (info.compressedSize != info.uncompressedSize)
+			return MZ_ZIP_INVALID_HEADER_OR_CORRUPTED;
+		if (archive.m_pRead(archive.m_pIO_opaque, dataOffset, output, outputSize) != outputSize)
+			return MZ_ZIP_FILE_READ_FAILED;
+		if (hasher != nullptr)
+			hasher->update(output, outputSize);
+	}
+
+	// deflated
+	else {
+		tinfl_decompressor inflator;
+		tinfl_init(&inflator);
+		size_t readBufferSize = partial ? PartialInflateReadBufferSize : InflateReadBufferSize;
+		std::vector<uint8_t> readBuffer(static_cast<size_t>(std::min<uint64_t>(info.compressedSize, readBufferSize)));
+		uint64_t readOffset = dataOffset;
+		uint64_t compressedRemaining = info.compressedSize;
+		size_t readPosition = 0, readAvailable = 0, outputOffset = 0;
+		tinfl_status status;
+		do {
+			if (budget != nullptr && !budget->checkTime())
+				return MZ_ZIP_INTERNAL_ERROR;
+			if (readAvailable == 0 && compressedRemaining > 0) {
+				size_t readSize = static_cast<size_t>(std::min<uint64_t>(compressedRemaining, readBuffer.size()));
+				if (archive.m_pRead(archive.m_pIO_opaque, readOffset, readBuffer.data(), readSize) != readSize)
+					return MZ_ZIP_FILE_READ_FAILED;
+				readOffset += readSize;
+				compressedRemaining -= readSize;
+				readPosition = 0;
+				readAvailable = readSize;
+			}
+
+			size_t inSize = readAvailable;
+			size_t outSize = outputSize - outputOffset;
+			status = tinfl_decompress(&inflator, readBuffer.data() + readPosition, &inSize,
+				output, output + outputOffset, &outSize,
+				TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF | (compressedRemaining > 0 ? TINFL_FLAG_HAS_MORE_INPUT : 0));
+			readPosition += inSize;
+			readAvailable -= inSize;
+			if (hasher != nullptr)
+				hasher->update(output + outputOffset, outSize);
+			outputOffset += outSize;
+		} while (status == TINFL_STATUS_NEEDS_MORE_INPUT);
+
+		if (status == TINFL_STATUS_HAS_MORE_OUTPUT)
+			return partial ? MZ_ZIP_NO_ERROR : MZ_ZIP_UNEXPECTED_DECOMPRESSED_SIZE;
+		if (status != TINFL_STATUS_DONE)
+			return MZ_ZIP_DECOMPRESSION_FAILED;
+		if (outputOffset != outputSize)
+			return MZ_ZIP_UNEXPECTED_DECOMPRESSED_SIZE;
+	}
+
+	if (!partial && mz_crc32(MZ_CRC32_INIT, output, outputSize) != info.crc32)
+		return MZ_ZIP_CRC_CHECK_FAILED;
+	return MZ_ZIP_NO_ERROR;
+}
+
+void* PblAppArchive::extractBinary(uint32_t index, size_t* size, bool verbose, uint8_t* hash, InputBudget* budget) const {
 	if (index >= binaries.size() || size == nullptr)
 		return nullptr;
-	size_t tmpSize;
-	void* result = mz_zip_reader_extract_to_heap(&archive, binaries[index].fileIndex, &tmpSize, 0);
-        *size = tmpSize;
-	if (!result && verbose) {
-		const char* errString = mz_zip_get_error_string(mz_zip_get_last_error(&archive));
-		std::cerr << "Could not extract binary for " << binaries[index].platform << ": " << errString << std::endl;
+	const FileInfo& info = binaries[index].file;
+	mz_zip_error error = MZ_ZIP_FILE_TOO_LARGE;
+	void* result = nullptr;
+	Sha256 hasher;
+	// the declared size is checked before anything is allocated, the output can never grow beyond it
+	if (budget != nullptr && !budget->reserveInflate(info.uncompressedSize)) {
+		verbose && std::cerr << "Not extracting binary for " << binaries[index].platform << ": " << budget->getError() << std::endl;
+		return nullptr;
+	}
+	if (info.uncompressedSize < SIZE_MAX) {
+		result = malloc(static_cast<size_t>(info.uncompressedSize) + 1); // never malloc(0)
+		error = result == nullptr
+			? MZ_ZIP_ALLOC_FAILED
+			: inflateFile(info, reinterpret_cast<uint8_t*>(result), static_cast<size_t>(info.uncompressedSize), hash != nullptr ? &hasher : nullptr, budget);
+	}
+
+	if (error != MZ_ZIP_NO_ERROR) {
+		verbose && std::cerr << "Could not extract binary for " << binaries[index].platform << ": "
+			<< (budget != nullptr && budget->isExceeded() ? budget->getError() : mz_zip_get_error_string(error)) << std::endl;
+		free(result);
+		return nullptr;
 	}
+	*size = static_cast<size_t>(info.uncompressedSize);
+	if (hash != nullptr)
+		hasher.finish(hash);
 	return result;
 }
+
+bool PblAppArchive::extractBinaryHeader(uint32_t index, PblAppHeader* header, bool verbose) const {
+	if (index >= binaries.size() || header == nullptr)
+		return false;
+	const FileInfo& info = binaries[index].file;
+	mz_zip_error error = info.uncompressedSize < sizeof(PblAppHeader)
+		? MZ_ZIP_UNEXPECTED_DECOMPRESSED_SIZE
+		: inflateFile(info, reinterpret_cast<uint8_t*>(header), sizeof(PblAppHeader));
+
+	if (error != MZ_ZIP_NO_ERROR) {
+		verbose && std::cerr << "Could not extract header for " << binaries[index].platform << ": " << mz_zip_get_error_string(error) << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool PblAppArchive::extractAppInfo(std::string& json, bool verbose) const {
+	if (!hasAppInfo) {
+		verbose && std::cerr << "Pebble app archive has no appinfo.json" << std::endl;
+		return false;
+	}
+	json.resize(static_cast<size_t>(appInfo.uncompressedSize));
+	mz_zip_error error = json.empty()
+		? MZ_ZIP_NO_ERROR
+		: inflateFile(appInfo, reinterpret_cast<uint8_t*>(&json[0]), json.size());
+
+	if (error != MZ_ZIP_NO_ERROR) {
+		verbose && std::cerr << "Could not extract appinfo.json: " << mz_zip_get_error_string(error) << std::endl;
+		return false;
+	}
+	return true;
+}
@@ -1,7 +1,20 @@
 #include "pbw_api_info.h"
 
-PblAppBinary::PblAppBinary(void* b, uint32_t s, PblLibrary* lib) :
-	library(lib), buffer(b), size(s) {
+static constexpr uint32_t BudgetCheckInterval = 4096; // code positions between two looks at the budget
+
+PblAppBinary::PblAppBinary(void* b, size_t s, PblLibrary* lib) :
+	library(lib), buffer(b), size(s), sdkVersion(0) {
+	memset(uuid, 0, sizeof(uuid));
+	if (size >= sizeof(PblAppHeader)) {
+		const PblAppHeader* header = getHeader();
+		memcpy(uuid, header->uuid, sizeof(uuid));
+		sdkVersion = (header->sdk_version_major << 8) | header->sdk_version_minor;
+	}
+}
+
+PblAppBinary::PblAppBinary(PblLibrary* lib, const std::vector<uint32_t>& functions, const uint8_t* appUUID, uint16_t appSdkVersion) :
+	library(lib), buffer(nullptr), size(0), usedFunctions(functions), sdkVersion(appSdkVersion) {
+	memcpy(uuid, appUUID, sizeof(uuid));
 }
 
 PblAppBinary::~PblAppBinary() {
@@ -9,13 +22,23 @@ PblAppBinary::~PblAppBinary() {
 		free(buffer);
 }
 
-uint32_t PblAppBinary::scan() {
+uint32_t PblAppBinary::scan(InputBudget* budget) {
+	// a binary without code after the header uses nothing
+	if (buffer == nullptr || size <= sizeof(PblAppHeader))
+		return usedFunctions.size();
+
 	uint8_t* code = reinterpret_cast<uint8_t*>(buffer);
 	uint8_t* end = code + size;
 	code += sizeof(PblAppHeader);
 
 	// TODO: This is a really slow memory search
-	for (; code != end; code++) {
+	uint32_t sinceBudgetCheck = 0;
+	for (; code < end; code++) {
+		if (budget != nullptr && ++sinceBudgetCheck == BudgetCheckInterval) {
+			sinceBudgetCheck = 0;
+			if (!budget->chargeScan(BudgetCheckInterval))
+				break;
+		}
 		for (uint32_t i = 0; i < library->getFunctionCount(); i++) {
 			const uint8_t* funcCode = reinterpret_cast<const uint8_t*>(library->getFunctionCode(i));
 			uint32_t funcCodeSize = library->getFunctionCodeSize(i);
@@ -39,10 +62,29 @@ uint32_t PblAppBinary::scan() {
 			}
 		}
 	}
+	if (budget != nullptr && code >= end)
+		budget->chargeScan(sinceBudgetCheck);
 
 	return usedFunctions.size();
 }
 
+uint32_t PblAppBinary::scan(ResultCache* cache, const uint8_t* binaryHash, InputBudget* budget) {
+	if (cache == nullptr)
+		return scan(budget);
+	if (cache->lookup(binaryHash, *library, usedFunctions))
+		return usedFunctions.size();
+	scan(budget);
+	if (budget == nullptr || !budget->isExceeded()) // an incomplete result must not be reused
+		cache->store(binaryHash, *library, usedFunctions);
+	return usedFunctions.size();
+}
+
+void PblAppBinary::releaseBuffer() {
+	free(buffer);
+	buffer = nullptr;
+	size = 0;
+}
+
 const char* PblAppBinary::getPlatformName() const {
 	return library->getPlatformName();
 }
@@ -51,6 +93,14 @@ const PblAppHeader* PblAppBinary::getHeader() const {
 	return (const PblAppHeader*)buffer;
 }
 
+const uint8_t* PblAppBinary::getUUID() const {
+	return uuid;
+}
+
+uint16_t PblAppBinary::getSdkVersion() const {
+	return sdkVersion;
+}
+
 uint32_t PblAppBinary::getUsedFunctionCount() const {
 	return usedFunctions.size();
 }
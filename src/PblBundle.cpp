@@ -0,0 +1,271 @@
+#include "pbw_api_info.h"
+
+static constexpr uint32_t TarBlockSize = 512;
+static constexpr uint32_t TarMagicOffset = 257;
+static constexpr char TarMagic[] = "ustar";
+static constexpr uint32_t TarMagicLen = 5;
+static constexpr uint32_t TarChecksumOffset = 148;
+static constexpr uint64_t MaxTarExtendedHeaderSize = 1024 * 1024; // long names and pax records
+
+struct TarHeader {
+	char name[100];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char size[12];
+	char mtime[12];
+	char checksum[8];
+	char typeflag;
+	char linkname[100];
+	char magic[6];
+	char version[2];
+	char uname[32];
+	char gname[32];
+	char devmajor[8];
+	char devminor[8];
+	char prefix[155];
+	char padding[12];
+};
+
+void* minizip_alloc(void* d, size_t items, size_t size);
+void minizip_free(void* d, void* block);
+void* minizip_realloc(void* d, void* block, size_t items, size_t size);
+
+static bool endsWith(const std::string& str, const char* suffix) {
+	size_t suffixLen = strlen(suffix);
+	return str.length() >= suffixLen && str.compare(str.length() - suffixLen, suffixLen, suffix) == 0;
+}
+
+// tar fields are not null-terminated if they are completly used
+static std::string tarString(const char* field, size_t maxLen) {
+	size_t len = 0;
+	while (len < maxLen && field[len] != '\0')
+		len++;
+	return std::string(field, len);
+}
+
+// octal numbers may have leading spaces and end with a space or null
+static bool tarOctal(const char* field, size_t length, uint64_t& value) {
+	value = 0;
+	size_t i = 0;
+	while (i < length && field[i] == ' ')
+		i++;
+	if (i >= length || field[i] < '0' || field[i] > '7')
+		return false;
+	while (i < length && field[i] >= '0' && field[i] <= '7')
+		value = value * 8 + (field[i++] - '0');
+	return true;
+}
+
+// sizes are octal or, for GNU tar and large files, base-256 with the high bit set
+static bool tarSize(const char* field, uint64_t& size) {
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(field);
+	size = 0;
+	if (bytes[0] & 0x80) {
+		size = bytes[0] & 0x7f;
+		for (int i = 1; i < 12; i++)
+			size = (size << 8) | bytes[i];
+		return true;
+	}
+	return tarOctal(field, 12, size);
+}
+
+// the checksum is the sum of all header bytes with the checksum field counted as spaces, old tars summed signed bytes
+static bool tarChecksumValid(const TarHeader& header) {
+	uint64_t checksum;
+	if (!tarOctal(header.checksum, sizeof(header.checksum), checksum))
+		return false;
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&header);
+	uint64_t unsignedSum = 0;
+	int64_t signedSum = 0;
+	for (uint32_t i = 0; i < TarBlockSize; i++) {
+		bool inField = i >= TarChecksumOffset && i < TarChecksumOffset + sizeof(header.checksum);
+		unsignedSum += inField ? ' ' : bytes[i];
+		signedSum += inField ? ' ' : static_cast<int8_t>(bytes[i]);
+	}
+	return checksum == unsignedSum || static_cast<int64_t>(checksum) == signedSum;
+}
+
+// finds the path record in a pax extended header ("<len> path=<value>\n")
+static bool paxPath(const std::string& records, std::string& path) {
+	size_t offset = 0;
+	while (offset < records.length()) {
+		size_t recordLen = strtoul(records.c_str() + offset, nullptr, 10);
+		size_t keyStart = records.find(' ', offset);
+		if (recordLen == 0 || keyStart == std::string::npos || offset + recordLen > records.length())
+			return false;
+		keyStart++;
+		if (records.compare(keyStart, 5, "path=") == 0) {
+			path = records.substr(keyStart + 5, offset + recordLen - keyStart - 6);
+			return true;
+		}
+		offset += recordLen;
+	}
+	return false;
+}
+
+PblBundle::PblBundle() : type(Type_None), zipIndex(0), tarFile(nullptr), tarFileSize(0), maxMemberSize(UINT64_MAX), failed(false) {
+	memset(&zipArchive, 0, sizeof(zipArchive));
+	zipArchive.m_pAlloc = minizip_alloc;
+	zipArchive.m_pFree = minizip_free;
+	zipArchive.m_pRealloc = minizip_realloc;
+}
+
+PblBundle::~PblBundle() {
+	if (type == Type_Zip)
+		mz_zip_reader_end(&zipArchive);
+	if (tarFile != nullptr)
+		fclose(tarFile);
+}
+
+bool PblBundle::load(const char* filename, bool verbose) {
+	FILE* fp = fopen(filename, "rb");
+	if (fp == nullptr) {
+		verbose && std::cerr << "Could not open bundle" << std::endl;
+		return false;
+	}
+	uint8_t block[TarBlockSize];
+	size_t blockSize = fread(block, 1, TarBlockSize, fp);
+
+	if (blockSize == TarBlockSize && memcmp(block + TarMagicOffset, TarMagic, TarMagicLen) == 0) {
+		fseeko(fp, 0, SEEK_END);
+		tarFileSize = ftello(fp);
+		fseeko(fp, 0, SEEK_SET);
+		tarFile = fp;
+		type = Type_Tar;
+		return true;
+	}
+	fclose(fp);
+
+	if (blockSize < 2 || block[0] != 'P' || block[1] != 'K') {
+		verbose && std::cerr << "Unknown bundle format" << std::endl;
+		return false;
+	}
+	// thousands of members are only iterated, there is no need for a sorted central directory
+	if (!mz_zip_reader_init_file(&zipArchive, filename, MZ_ZIP_FLAG_DO_NOT_SORT_CENTRAL_DIRECTORY)) {
+		verbose && std::cerr << "Could not open bundle: " << mz_zip_get_error_string(mz_zip_get_last_error(&zipArchive)) << std::endl;
+		return false;
+	}
+	type = Type_Zip;
+	return true;
+}
+
+void PblBundle::setMaxMemberSize(uint64_t size) {
+	maxMemberSize = size;
+}
+
+bool PblBundle::nextApp(std::string& name, std::vector<uint8_t>& buffer, std::string& error, bool verbose) {
+	buffer.clear();
+	error.clear();
+	if (type == Type_Zip)
+		return nextZipApp(name, buffer, error, verbose);
+	else if (type == Type_Tar)
+		return nextTarApp(name, buffer, error, verbose);
+	else
+		return false;
+}
+
+bool PblBundle::hasFailed() const {
+	return failed;
+}
+
+// members that cannot be read are still returned, but with an empty buffer
+bool PblBundle::nextZipApp(std::string& name, std::vector<uint8_t>& buffer, std::string& error, bool verbose) {
+	uint32_t fileCount = mz_zip_reader_get_num_files(&zipArchive);
+	for (; zipIndex < fileCount; zipIndex++) {
+		mz_zip_archive_file_stat stat;
+		if (!mz_zip_reader_file_stat(&zipArchive, zipIndex, &stat) || stat.m_is_directory)
+			continue;
+		name = stat.m_filename;
+		if (!endsWith(name, ".pbw"))
+			continue;
+
+		// the size is only taken from the directory, it is bounded before anything is allocated
+		zipIndex++;
+		if (stat.m_uncomp_size > maxMemberSize || stat.m_uncomp_size > SIZE_MAX) {
+			error = "Bundle member is larger than " + std::to_string(maxMemberSize) + " bytes";
+			verbose && std::cerr << "Could not extract \"" << name << "\" from bundle: " << error << std::endl;
+			return true;
+		}
+		buffer.resize(static_cast<size_t>(stat.m_uncomp_size));
+		if (!mz_zip_reader_extract_to_mem(&zipArchive, zipIndex - 1, buffer.data(), buffer.size(), 0)) {
+			error = std::string("Could not extract bundle member: ") + mz_zip_get_error_string(mz_zip_get_last_error(&zipArchive));
+			verbose && std::cerr << "Could not extract \"" << name << "\" from bundle: " << error << std::endl;
+			buffer.clear();
+		}
+		return true;
+	}
+	return false;
+}
+
+// a broken header ends the bundle, the following members cannot be found anymore
+bool PblBundle::nextTarApp(std::string& name, std::vector<uint8_t>& buffer, std::string& error, bool verbose) {
+	std::string longName;
+	TarHeader header;
+	while (fread(&header, 1, TarBlockSize, tarFile) == TarBlockSize) {
+		if (header.name[0] == '\0') // end of archive
+			return false;
+
+		// sizes are only trusted as far as the rest of the file reaches
+		uint64_t size;
+		uint64_t remaining = tarFileSize - static_cast<uint64_t>(ftello(tarFile));
+		if (!tarChecksumValid(header) || !tarSize(header.size, size) || size > remaining) {
+			std::cerr << "Invalid tar header in bundle" << std::endl;
+			failed = true;
+			return false;
+		}
+		uint64_t paddedSize = (size + TarBlockSize - 1) / TarBlockSize * TarBlockSize;
+
+		// GNU long names and pax headers apply to the following member
+		if (header.typeflag == 'L' || header.typeflag == 'x') {
+			if (size > MaxTarExtendedHeaderSize) {
+				std::cerr << "Invalid tar header in bundle" << std::endl;
+				failed = true;
+				return false;
+			}
+			std::string data(static_cast<size_t>(size), '\0');
+			if (size > 0 && fread(&data[0], 1, data.size(), tarFile) != data.size()) {
+				std::cerr << "Could not read tar header in bundle" << std::endl;
+				failed = true;
+				return false;
+			}
+			fseeko(tarFile, paddedSize - size, SEEK_CUR);
+			if (header.typeflag == 'L')
+				longName = tarString(data.c_str(), data.size());
+			else
+				paxPath(data, longName);
+			continue;
+		}
+
+		if (!longName.empty())
+			name = longName;
+		else if (header.prefix[0] != '\0')
+			name = tarString(header.prefix, sizeof(header.prefix)) + "/" + tarString(header.name, sizeof(header.name));
+		else
+			name = tarString(header.name, sizeof(header.name));
+		longName.clear();
+
+		bool isRegular = header.typeflag == '0' || header.typeflag == '\0';
+		if (!isRegular || !endsWith(name, ".pbw")) {
+			fseeko(tarFile, paddedSize, SEEK_CUR);
+			continue;
+		}
+		if (size > maxMemberSize || size > SIZE_MAX) {
+			error = "Bundle member is larger than " + std::to_string(maxMemberSize) + " bytes";
+			verbose && std::cerr << "Could not read \"" << name << "\" from bundle: " << error << std::endl;
+			fseeko(tarFile, paddedSize, SEEK_CUR);
+			return true;
+		}
+
+		buffer.resize(static_cast<size_t>(size));
+		if (fread(buffer.data(), 1, buffer.size(), tarFile) != buffer.size()) {
+			error = "Could not read bundle member";
+			verbose && std::cerr << "Could not read \"" << name << "\" from bundle" << std::endl;
+			buffer.clear();
+			return true;
+		}
+		fseeko(tarFile, paddedSize - size, SEEK_CUR);
+		return true;
+	}
+	return false;
+}
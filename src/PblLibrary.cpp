@@ -2,6 +2,9 @@
 
 #include <iostream>
 
+// part of the library signature, has to change whenever PblAppBinary::scan finds different functions
+static constexpr uint32_t ScanVersion = 1;
+
 static bool is_little_endian() {
 	union {
 		uint8_t bytes[4];
@@ -53,10 +56,16 @@ public:
 	}
 };
 
-PblLibrary::PblLibrary(const char* cstrPlatformName) : platformName(cstrPlatformName) {
+PblLibrary::PblLibrary(const char* cstrPlatformName, StringPool* functionNames) :
+	names(functionNames), ownsNames(functionNames == nullptr), platformName(cstrPlatformName) {
+	if (ownsNames)
+		names = new StringPool();
+	memset(signature, 0, sizeof(signature));
 }
 
 PblLibrary::~PblLibrary() {
+	if (ownsNames)
+		delete names;
 }
 
 bool PblLibrary::loadFromArArchive(ArArchive& archive, bool verbose) {
@@ -75,35 +84,41 @@ bool PblLibrary::loadFromArArchive(ArArchive& archive, bool verbose) {
 		return false;
 	}
 
+	if (archive.getFileSize(fileIdx) > UINT32_MAX) {
+		verbose && std::cerr << "Invalid pebble library content for " << platformName << std::endl;
+		return false;
+	}
+
 	// read as elf file
-	ElfMemoryLoader loader(archive.getFileBuffer(fileIdx), archive.getFileSize(fileIdx));
+	ElfMemoryLoader loader(archive.getFileBuffer(fileIdx), static_cast<uint32_t>(archive.getFileSize(fileIdx)));
 	return loadFromELF(&loader, verbose);
 }
 
 bool PblLibrary::loadFromELF(ELFIO::Loader* loader, bool verbose) {
 	// the pebble libraries have section for every export function
 	// these sections are named .text.<function_name>
+	ELFIO::elfio elf;
 	if (!elf.load(loader)) {
 		verbose && std::cerr << "Could not load ELF file for " << platformName << std::endl;
 		return false;
 	}
 
 	// Find functions
+	functions.reserve(elf.sections.size());
 	auto itSection = elf.sections.begin();
 	for (; itSection != elf.sections.end(); ++itSection) {
 		if ((*itSection)->get_name().find(".text.") == 0) {
+			std::string name = (*itSection)->get_name().substr(6);
 			Function function;
-			function.section = *itSection;
-			function.name = (*itSection)->get_name().substr(6);
 			function.relocatedOffset = UINT32_MAX;
 			function.symbolTableOffset = UINT32_MAX;
 
 			// find relocation entry
-			ELFIO::section* relocSection = elf.sections[".rel.text." + function.name];
+			ELFIO::section* relocSection = elf.sections[".rel.text." + name];
 			if (relocSection != nullptr) {
 				ELFIO::relocation_section_accessor reloc(elf, relocSection);
 				if (reloc.get_entries_num() > 1) {
-					verbose && std::cerr << "Ignored function \"" << function.name << "\" for " << platformName <<
+					verbose && std::cerr << "Ignored function \"" << name << "\" for " << platformName <<
 						" because of too many relocation entries" << std::endl;
 					continue;
 				}
@@ -112,7 +127,7 @@ bool PblLibrary::loadFromELF(ELFIO::Loader* loader, bool verbose) {
 					ELFIO::Elf_Word symbol, type;
 					ELFIO::Elf_Sxword addend;
 					if (!reloc.get_entry(0, offset, symbol, type, addend) || type != 30) {
-						verbose && std::cerr << "Ignored function \"" << function.name << "\" for " << platformName <<
+						verbose && std::cerr << "Ignored function \"" << name << "\" for " << platformName <<
 							" because invalid relocation entry" << std::endl;
 						continue;
 					}
@@ -125,17 +140,46 @@ bool PblLibrary::loadFromELF(ELFIO::Loader* loader, bool verbose) {
 			if ((*itSection)->get_size() == 12)
 				function.symbolTableOffset = swap_to_le(*(uint32_t*)((*itSection)->get_data() + 8)) / 4;
 			else if (verbose)
-				std::cerr << "Unknown function format \"" << function.name << "\" is " << (*itSection)->get_size() << "B long" << std::endl;
-
+				std::cerr << "Unknown function format \"" << name << "\" is " << (*itSection)->get_size() << "B long" << std::endl;
+
+			// the code of all functions is kept in one buffer
+			const char* data = (*itSection)->get_data();
+			function.nameId = names->intern(name);
+			function.codeOffset = static_cast<uint32_t>(code.size());
+			function.codeSize = data != nullptr ? static_cast<uint32_t>((*itSection)->get_size()) : 0;
+			code.insert(code.end(), data, data + function.codeSize);
 			functions.push_back(function);
 		}
 	}
 
-	verbose && std::cerr << "Found " << functions.size() << " functions for " << platformName << std::endl;
+	// only the functions stay resident, the ELF file is released on return
+	functions.shrink_to_fit();
+	code.shrink_to_fit();
+	verbose && std::cerr << "Found " << functions.size() << " functions for " << platformName << " (" << code.size() << " bytes of code)" << std::endl;
 
+	computeSignature();
 	return functions.size() > 0;
 }
 
+// every value is hashed with a fixed size, so different function lists cannot produce the same stream
+void PblLibrary::computeSignature() {
+	Sha256 hasher;
+	uint32_t header[3] = { swap_to_le(ScanVersion), swap_to_le(static_cast<uint32_t>(platformName.size())), swap_to_le(getFunctionCount()) };
+	hasher.update(header, sizeof(header));
+	hasher.update(platformName.data(), platformName.size());
+	for (uint32_t i = 0; i < getFunctionCount(); i++) {
+		uint32_t nameLength = names->getLength(functions[i].nameId);
+		uint32_t values[4] = {
+			swap_to_le(nameLength), swap_to_le(getFunctionCodeSize(i)),
+			swap_to_le(functions[i].relocatedOffset), swap_to_le(functions[i].symbolTableOffset)
+		};
+		hasher.update(values, sizeof(values));
+		hasher.update(names->getString(functions[i].nameId), nameLength);
+		hasher.update(getFunctionCode(i), getFunctionCodeSize(i));
+	}
+	hasher.finish(signature);
+}
+
 const char* PblLibrary::getPlatformName() const {
 	return platformName.c_str();
 }
@@ -148,21 +192,32 @@ const char* PblLibrary::getFunctionName(uint32_t index) const {
 	if (index >= functions.size())
 		return nullptr;
 	else
-		return functions[index].name.c_str();
+		return names->getString(functions[index].nameId);
+}
+
+uint32_t PblLibrary::getFunctionNameId(uint32_t index) const {
+	if (index >= functions.size())
+		return UINT32_MAX;
+	else
+		return functions[index].nameId;
+}
+
+const StringPool& PblLibrary::getFunctionNames() const {
+	return *names;
 }
 
 const void* PblLibrary::getFunctionCode(uint32_t index) const {
 	if (index >= functions.size())
 		return nullptr;
 	else
-		return reinterpret_cast<const void*>(functions[index].section->get_data());
+		return code.data() + functions[index].codeOffset;
 }
 
 uint32_t PblLibrary::getFunctionCodeSize(uint32_t index) const {
 	if (index >= functions.size())
 		return 0;
 	else
-		return static_cast<uint32_t>(functions[index].section->get_size());
+		return functions[index].codeSize;
 }
 
 uint32_t PblLibrary::getFunctionRelocatedOffset(uint32_t index) const {
@@ -178,3 +233,7 @@ uint32_t PblLibrary::getFunctionSymbolTableOffset(uint32_t index) const {
 	else
 		return functions[index].symbolTableOffset;
 }
+
+const uint8_t* PblLibrary::getSignature() const {
+	return signature;
+}
@@ -0,0 +1,204 @@
+#include "pbw_api_info.h"
+
+#include <errno.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static constexpr char CacheMagic[8] = { 'P', 'B', 'W', 'C', 'A', 'C', 'H', 'E' };
+static constexpr uint32_t CacheVersion = 1;
+static constexpr uint32_t CacheHeaderSize = 16; // magic, version, reserved
+static constexpr uint32_t RecordMagic = 0x52574250; // "PBWR"
+static constexpr uint32_t RecordHeaderSize = 8 + 2 * Sha256::DigestSize; // magic, function count, both hashes
+static constexpr uint32_t RecordChecksumSize = 4;
+
+static uint32_t readLE32(const uint8_t* p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static void appendLE32(std::string& data, uint32_t value) {
+	for (int i = 0; i < 4; i++)
+		data.push_back(static_cast<char>((value >> (i * 8)) & 0xff));
+}
+
+ResultCache::ResultCache() : fd(-1), mapping(nullptr), mappingSize(0), hits(0), misses(0) {
+}
+
+ResultCache::~ResultCache() {
+#ifndef WIN32
+	if (mapping != nullptr)
+		munmap(mapping, mappingSize);
+	if (fd >= 0)
+		close(fd);
+#endif
+}
+
+std::string ResultCache::makeKey(const uint8_t* binaryHash, const PblLibrary& library) {
+	std::string key(reinterpret_cast<const char*>(binaryHash), Sha256::DigestSize);
+	key.append(reinterpret_cast<const char*>(library.getSignature()), Sha256::DigestSize);
+	return key;
+}
+
+bool ResultCache::open(const std::string& path, bool verbose) {
+#ifdef WIN32
+	verbose && std::cerr << "The result cache is not supported on windows" << std::endl;
+	return false;
+#else
+	fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		verbose && std::cerr << "Could not open result cache: " << strerror(errno) << std::endl;
+		return false;
+	}
+
+	// the lock keeps writers away while a new file gets its header or a torn record is cut off
+	while (flock(fd, LOCK_EX) != 0 && errno == EINTR)
+		;
+	struct stat cacheStat;
+	bool success = fstat(fd, &cacheStat) == 0;
+	uint64_t fileSize = success ? static_cast<uint64_t>(cacheStat.st_size) : 0;
+	if (success && fileSize == 0) {
+		std::string header(CacheMagic, sizeof(CacheMagic));
+		appendLE32(header, CacheVersion);
+		appendLE32(header, 0);
+		success = write(fd, header.data(), header.size()) == static_cast<ssize_t>(header.size());
+		fileSize = header.size();
+	}
+	if (success && fileSize > SIZE_MAX)
+		success = false;
+	if (success) {
+		mappingSize = static_cast<size_t>(fileSize);
+		mapping = mmap(nullptr, mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+		if (mapping == MAP_FAILED) {
+			mapping = nullptr;
+			success = false;
+		}
+	}
+
+	uint64_t validSize = 0;
+	if (success && !readRecords(validSize)) {
+		verbose && std::cerr << "Not a result cache" << std::endl;
+		success = false;
+	}
+	// a writer died in the middle of a record, later records would not be found behind it
+	else if (success && validSize < fileSize) {
+		verbose && std::cerr << "Removing " << (fileSize - validSize) << " bytes of an incomplete record from the result cache" << std::endl;
+		success = ftruncate(fd, static_cast<off_t>(validSize)) == 0;
+	}
+	flock(fd, LOCK_UN);
+
+	if (!success) {
+		verbose && std::cerr << "Could not read result cache" << std::endl;
+		if (mapping != nullptr)
+			munmap(mapping, mappingSize);
+		mapping = nullptr;
+		close(fd);
+		fd = -1;
+		return false;
+	}
+	verbose && std::cerr << "Loaded " << entries.size() << " cached results" << std::endl;
+	return true;
+#endif
+}
+
+// stops at the first record that is incomplete or damaged, validSize is where the next record belongs
+bool ResultCache::readRecords(uint64_t& validSize) {
+	const uint8_t* data = reinterpret_cast<const uint8_t*>(mapping);
+	if (mappingSize < CacheHeaderSize || memcmp(data, CacheMagic, sizeof(CacheMagic)) != 0 ||
+		readLE32(data + sizeof(CacheMagic)) != CacheVersion)
+		return false;
+
+	size_t offset = CacheHeaderSize;
+	while (mappingSize - offset >= RecordHeaderSize + RecordChecksumSize) {
+		const uint8_t* record = data + offset;
+		uint32_t functionCount = readLE32(record + 4);
+		if (readLE32(record) != RecordMagic || functionCount > (mappingSize - offset - RecordHeaderSize - RecordChecksumSize) / 4)
+			break;
+		size_t recordSize = RecordHeaderSize + functionCount * 4;
+		if (mz_crc32(MZ_CRC32_INIT, record, recordSize) != readLE32(record + recordSize))
+			break;
+
+		std::string key(reinterpret_cast<const char*>(record + 8), 2 * Sha256::DigestSize);
+		if (entries.find(key) == entries.end()) {
+			Entry& entry = entries[key];
+			entry.mappedFunctions = record + RecordHeaderSize;
+			entry.functionCount = functionCount;
+		}
+		offset += recordSize + RecordChecksumSize;
+	}
+	validSize = offset;
+	return true;
+}
+
+bool ResultCache::lookup(const uint8_t* binaryHash, const PblLibrary& library, std::vector<uint32_t>& functions) {
+	std::string key = makeKey(binaryHash, library);
+	std::lock_guard<std::mutex> lock(mutex);
+	auto itEntry = entries.find(key);
+	if (itEntry == entries.end()) {
+		misses++;
+		return false;
+	}
+
+	const Entry& entry = itEntry->second;
+	if (entry.mappedFunctions == nullptr)
+		functions = entry.functions;
+	else {
+		functions.resize(entry.functionCount);
+		for (uint32_t i = 0; i < entry.functionCount; i++)
+			functions[i] = readLE32(entry.mappedFunctions + i * 4);
+	}
+	hits++;
+	return true;
+}
+
+bool ResultCache::store(const uint8_t* binaryHash, const PblLibrary& library, const std::vector<uint32_t>& functions) {
+#ifdef WIN32
+	return false;
+#else
+	std::string key = makeKey(binaryHash, library);
+	std::string record;
+	record.reserve(RecordHeaderSize + functions.size() * 4 + RecordChecksumSize);
+	appendLE32(record, RecordMagic);
+	appendLE32(record, static_cast<uint32_t>(functions.size()));
+	record.append(key);
+	for (auto itFunction = functions.begin(); itFunction != functions.end(); ++itFunction)
+		appendLE32(record, *itFunction);
+	appendLE32(record, static_cast<uint32_t>(mz_crc32(MZ_CRC32_INIT, reinterpret_cast<const uint8_t*>(record.data()), record.size())));
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (fd < 0 || entries.find(key) != entries.end())
+		return false;
+
+	// other processes append to the same file, the lock keeps the record in one piece
+	while (flock(fd, LOCK_EX) != 0 && errno == EINTR)
+		;
+	size_t written = 0;
+	while (written < record.size()) {
+		ssize_t size = write(fd, record.data() + written, record.size() - written);
+		if (size < 0 && errno == EINTR)
+			continue;
+		if (size <= 0)
+			break;
+		written += size;
+	}
+	flock(fd, LOCK_UN);
+
+	Entry& entry = entries[key];
+	entry.mappedFunctions = nullptr;
+	entry.functionCount = static_cast<uint32_t>(functions.size());
+	entry.functions = functions;
+	return written == record.size();
+#endif
+}
+
+uint32_t ResultCache::getHits() const {
+	return hits;
+}
+
+uint32_t ResultCache::getMisses() const {
+	return misses;
+}
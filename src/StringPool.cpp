@@ -0,0 +1,90 @@
+#include "pbw_api_info.h"
+
+static constexpr size_t BlockSize = 16 * 1024; // strings are packed into blocks that never move
+static constexpr uint32_t InitialSlotCount = 256;
+
+// FNV-1a
+static uint32_t hashString(const char* str, size_t length) {
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < length; i++) {
+		hash ^= static_cast<uint8_t>(str[i]);
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+StringPool::StringPool() : blockUsed(BlockSize), slots(InitialSlotCount, 0) {
+}
+
+StringPool::~StringPool() {
+	for (auto itBlock = blocks.begin(); itBlock != blocks.end(); ++itBlock)
+		delete[] *itBlock;
+}
+
+char* StringPool::allocate(size_t size) {
+	// a string longer than a block gets a block of its own, the current block stays in use
+	if (size > BlockSize) {
+		char* block = new char[size];
+		blocks.insert(blocks.end() - (blocks.empty() ? 0 : 1), block);
+		return block;
+	}
+	if (blockUsed + size > BlockSize) {
+		blocks.push_back(new char[BlockSize]);
+		blockUsed = 0;
+	}
+	char* str = blocks.back() + blockUsed;
+	blockUsed += size;
+	return str;
+}
+
+// the slots hold id + 1, 0 marks a free slot, at most half of them are used
+void StringPool::growSlots() {
+	std::vector<uint32_t> grown(slots.size() * 2, 0);
+	uint32_t mask = static_cast<uint32_t>(grown.size() - 1);
+	for (uint32_t id = 0; id < strings.size(); id++) {
+		uint32_t slot = hashes[id] & mask;
+		while (grown[slot] != 0)
+			slot = (slot + 1) & mask;
+		grown[slot] = id + 1;
+	}
+	slots.swap(grown);
+}
+
+uint32_t StringPool::intern(const char* str, size_t length) {
+	uint32_t hash = hashString(str, length);
+	uint32_t mask = static_cast<uint32_t>(slots.size() - 1);
+	uint32_t slot = hash & mask;
+	for (; slots[slot] != 0; slot = (slot + 1) & mask) {
+		uint32_t id = slots[slot] - 1;
+		if (hashes[id] == hash && lengths[id] == length && memcmp(strings[id], str, length) == 0)
+			return id;
+	}
+
+	uint32_t id = static_cast<uint32_t>(strings.size());
+	char* copy = allocate(length + 1);
+	memcpy(copy, str, length);
+	copy[length] = '\0';
+	strings.push_back(copy);
+	lengths.push_back(static_cast<uint32_t>(length));
+	hashes.push_back(hash);
+	slots[slot] = id + 1;
+	if (strings.size() * 2 > slots.size())
+		growSlots();
+	return id;
+}
+
+uint32_t StringPool::intern(const std::string& str) {
+	return intern(str.data(), str.size());
+}
+
+const char* StringPool::getString(uint32_t id) const {
+	return id < strings.size() ? strings[id] : nullptr;
+}
+
+uint32_t StringPool::getLength(uint32_t id) const {
+	return id < lengths.size() ? lengths[id] : 0;
+}
+
+uint32_t StringPool::getCount() const {
+	return static_cast<uint32_t>(strings.size());
+}
@@ -0,0 +1,107 @@
+#include "pbw_api_info.h"
+
+// the worker the current thread belongs to, used to keep submitted tasks local
+static thread_local ThreadPool* currentPool = nullptr;
+static thread_local uint32_t currentWorker = 0;
+
+ThreadPool::ThreadPool(uint32_t threadCount) :
+	queuedTasks(0), pendingTasks(0), nextWorker(0), stopping(false) {
+	if (threadCount == 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	for (uint32_t i = 0; i < threadCount; i++)
+		workers.push_back(new Worker());
+	for (uint32_t i = 0; i < threadCount; i++)
+		threads.emplace_back(&ThreadPool::run, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(stateMutex);
+		stopping = true;
+	}
+	taskAvailable.notify_all();
+	for (auto itThread = threads.begin(); itThread != threads.end(); ++itThread)
+		itThread->join();
+	for (auto itWorker = workers.begin(); itWorker != workers.end(); ++itWorker)
+		delete *itWorker;
+}
+
+uint32_t ThreadPool::getThreadCount() const {
+	return workers.size();
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+	uint32_t workerIndex;
+	{
+		std::lock_guard<std::mutex> lock(stateMutex);
+		workerIndex = currentPool == this ? currentWorker : nextWorker++ % workers.size();
+		pendingTasks++;
+	}
+
+	Worker* worker = workers[workerIndex];
+	{
+		std::lock_guard<std::mutex> lock(worker->mutex);
+		worker->tasks.push_back(std::move(task));
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(stateMutex);
+		queuedTasks++;
+	}
+	taskAvailable.notify_one();
+}
+
+void ThreadPool::wait() {
+	std::unique_lock<std::mutex> lock(stateMutex);
+	allDone.wait(lock, [this]() { return pendingTasks == 0; });
+}
+
+// takes the newest own task or steals the oldest task of another worker
+bool ThreadPool::popTask(uint32_t workerIndex, std::function<void()>& task) {
+	Worker* own = workers[workerIndex];
+	{
+		std::lock_guard<std::mutex> lock(own->mutex);
+		if (!own->tasks.empty()) {
+			task = std::move(own->tasks.back());
+			own->tasks.pop_back();
+			return true;
+		}
+	}
+
+	for (uint32_t i = 1; i < workers.size(); i++) {
+		Worker* victim = workers[(workerIndex + i) % workers.size()];
+		std::lock_guard<std::mutex> lock(victim->mutex);
+		if (!victim->tasks.empty()) {
+			task = std::move(victim->tasks.front());
+			victim->tasks.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+void ThreadPool::run(uint32_t workerIndex) {
+	currentPool = this;
+	currentWorker = workerIndex;
+
+	std::function<void()> task;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(stateMutex);
+			taskAvailable.wait(lock, [this]() { return queuedTasks > 0 || stopping; });
+			if (queuedTasks == 0)
+				return;
+			queuedTasks--;
+		}
+
+		// a task was counted, so it is in one of the queues
+		while (!popTask(workerIndex, task))
+			std::this_thread::yield();
+		task();
+		task = nullptr;
+
+		std::lock_guard<std::mutex> lock(stateMutex);
+		if (--pendingTasks == 0)
+			allDone.notify_all();
+	}
+}
@@ -0,0 +1,153 @@
+#include "pbw_api_info.h"
+
+#include <algorithm>
+
+struct UsageAggregator::ThreadTables {
+	uint32_t apps = 0, failedApps = 0;
+	uint32_t binaryCount = 0; // numbers the binaries, so duplicate matches in one binary count once
+	std::vector<PlatformTotals> platforms;
+	std::vector<std::vector<uint32_t>> lastBinary; // per platform and symbol table offset
+};
+
+// the tables of the aggregator this thread counted for last
+struct ThreadCache {
+	uint64_t aggregatorId = 0;
+	void* tables = nullptr;
+};
+
+static std::atomic<uint64_t> nextAggregatorId(1);
+static thread_local ThreadCache threadCache;
+
+UsageAggregator::UsageAggregator(const std::vector<PblLibrary*>& libraries) :
+	id(nextAggregatorId++), apps(0), failedApps(0), platforms(libraries.size()) {
+	for (uint32_t i = 0; i < libraries.size(); i++) {
+		PlatformTotals& platform = platforms[i];
+		platform.name = libraries[i]->getPlatformName();
+		for (uint32_t j = 0; j < libraries[i]->getFunctionCount(); j++) {
+			uint32_t symbolTableOffset = libraries[i]->getFunctionSymbolTableOffset(j);
+			if (symbolTableOffset == UINT32_MAX)
+				continue;
+			if (symbolTableOffset >= platform.functions.size())
+				platform.functions.resize(symbolTableOffset + 1);
+			if (platform.functions[symbolTableOffset].name.empty())
+				platform.functions[symbolTableOffset].name = libraries[i]->getFunctionName(j);
+		}
+	}
+}
+
+UsageAggregator::~UsageAggregator() {
+	for (auto itTables = threadTables.begin(); itTables != threadTables.end(); ++itTables)
+		delete *itTables;
+}
+
+UsageAggregator::ThreadTables& UsageAggregator::tablesOfThread() {
+	if (threadCache.aggregatorId == id)
+		return *reinterpret_cast<ThreadTables*>(threadCache.tables);
+
+	ThreadTables* tables = new ThreadTables();
+	tables->platforms.resize(platforms.size());
+	tables->lastBinary.resize(platforms.size());
+	for (uint32_t i = 0; i < platforms.size(); i++) {
+		tables->platforms[i].functions.resize(platforms[i].functions.size());
+		tables->lastBinary[i].resize(platforms[i].functions.size(), 0);
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		threadTables.push_back(tables);
+	}
+	threadCache.aggregatorId = id;
+	threadCache.tables = tables;
+	return *tables;
+}
+
+void UsageAggregator::add(const BatchScanner::AppResult& result) {
+	ThreadTables& tables = tablesOfThread();
+	tables.apps++;
+	if (result.binaries.empty()) {
+		tables.failedApps++;
+		return;
+	}
+
+	for (auto itBinary = result.binaries.begin(); itBinary != result.binaries.end(); ++itBinary) {
+		uint32_t platformIndex = 0;
+		while (platformIndex < platforms.size() && platforms[platformIndex].name != (*itBinary)->getPlatformName())
+			platformIndex++;
+		if (platformIndex >= platforms.size())
+			continue;
+
+		PlatformTotals& platform = tables.platforms[platformIndex];
+		std::vector<uint32_t>& lastBinary = tables.lastBinary[platformIndex];
+		uint32_t binaryNumber = ++tables.binaryCount;
+		uint16_t sdkVersion = (*itBinary)->getSdkVersion();
+		platform.binaries++;
+		platform.sdkVersions[sdkVersion]++;
+		for (uint32_t i = 0; i < (*itBinary)->getUsedFunctionCount(); i++) {
+			uint32_t symbolTableOffset = (*itBinary)->getUsedFunctionSymbolTableOffset(i);
+			if (symbolTableOffset >= platform.functions.size() || lastBinary[symbolTableOffset] == binaryNumber)
+				continue;
+			lastBinary[symbolTableOffset] = binaryNumber;
+			FunctionTotals& function = platform.functions[symbolTableOffset];
+			function.apps++;
+			function.firstSdk = std::min(function.firstSdk, sdkVersion);
+			function.lastSdk = std::max(function.lastSdk, sdkVersion);
+		}
+	}
+}
+
+void UsageAggregator::addPlatform(PlatformTotals& totals, const PlatformTotals& other) {
+	totals.binaries += other.binaries;
+	for (auto itVersion = other.sdkVersions.begin(); itVersion != other.sdkVersions.end(); ++itVersion)
+		totals.sdkVersions[itVersion->first] += itVersion->second;
+	if (other.functions.size() > totals.functions.size())
+		totals.functions.resize(other.functions.size());
+	for (uint32_t i = 0; i < other.functions.size(); i++) {
+		FunctionTotals& function = totals.functions[i];
+		const FunctionTotals& otherFunction = other.functions[i];
+		if (function.name.empty())
+			function.name = otherFunction.name;
+		function.apps += otherFunction.apps;
+		function.firstSdk = std::min(function.firstSdk, otherFunction.firstSdk);
+		function.lastSdk = std::max(function.lastSdk, otherFunction.lastSdk);
+	}
+}
+
+void UsageAggregator::finish() {
+	for (auto itTables = threadTables.begin(); itTables != threadTables.end(); ++itTables) {
+		apps += (*itTables)->apps;
+		failedApps += (*itTables)->failedApps;
+		for (uint32_t i = 0; i < platforms.size(); i++)
+			addPlatform(platforms[i], (*itTables)->platforms[i]);
+		delete *itTables;
+	}
+	threadTables.clear();
+	// the tables the threads know are gone, a later add starts new ones
+	id = nextAggregatorId++;
+}
+
+void UsageAggregator::addTotals(uint32_t otherApps, uint32_t otherFailedApps, const std::vector<PlatformTotals>& otherPlatforms) {
+	apps += otherApps;
+	failedApps += otherFailedApps;
+	for (auto itOther = otherPlatforms.begin(); itOther != otherPlatforms.end(); ++itOther) {
+		auto itPlatform = platforms.begin();
+		while (itPlatform != platforms.end() && itPlatform->name != itOther->name)
+			++itPlatform;
+		if (itPlatform == platforms.end()) {
+			platforms.push_back(PlatformTotals());
+			platforms.back().name = itOther->name;
+			itPlatform = platforms.end() - 1;
+		}
+		addPlatform(*itPlatform, *itOther);
+	}
+}
+
+uint32_t UsageAggregator::getAppCount() const {
+	return apps;
+}
+
+uint32_t UsageAggregator::getFailedAppCount() const {
+	return failedApps;
+}
+
+const std::vector<UsageAggregator::PlatformTotals>& UsageAggregator::getPlatforms() const {
+	return platforms;
+}
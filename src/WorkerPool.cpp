@@ -0,0 +1,376 @@
+#include "pbw_api_info.h"
+
+#include <algorithm>
+#include <errno.h>
+
+#ifndef WIN32
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#endif
+
+static constexpr uint32_t MaxMessageSize = 64 * 1024 * 1024;
+static constexpr uint32_t WatchdogGraceMilliseconds = 1000; // on top of the time budget, for workers that stopped cooperating
+
+static uint32_t readLE32(const uint8_t* p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static void appendLE32(std::string& data, uint32_t value) {
+	for (int i = 0; i < 4; i++)
+		data.push_back(static_cast<char>((value >> (i * 8)) & 0xff));
+}
+
+#ifndef WIN32
+static bool sendAll(int fd, const char* data, size_t size) {
+	while (size > 0) {
+		ssize_t sent = send(fd, data, size, MSG_NOSIGNAL); // a dead worker must not kill the parent with SIGPIPE
+		if (sent < 0 && errno == EINTR)
+			continue;
+		if (sent <= 0)
+			return false;
+		data += sent;
+		size -= sent;
+	}
+	return true;
+}
+
+static bool receiveAll(int fd, char* data, size_t size) {
+	while (size > 0) {
+		ssize_t received = recv(fd, data, size, 0);
+		if (received < 0 && errno == EINTR)
+			continue;
+		if (received <= 0)
+			return false;
+		data += received;
+		size -= received;
+	}
+	return true;
+}
+
+// messages are prefixed by their size as 4 byte little endian integer
+static bool sendMessage(int fd, const std::string& message) {
+	std::string header;
+	appendLE32(header, static_cast<uint32_t>(message.size()));
+	return sendAll(fd, header.data(), header.size()) && sendAll(fd, message.data(), message.size());
+}
+
+static bool receiveMessage(int fd, std::string& message) {
+	uint8_t header[4];
+	if (!receiveAll(fd, reinterpret_cast<char*>(header), sizeof(header)))
+		return false;
+	uint32_t size = readLE32(header);
+	if (size > MaxMessageSize)
+		return false;
+	message.resize(size);
+	return size == 0 || receiveAll(fd, &message[0], size);
+}
+#endif
+
+WorkerPool::WorkerPool(const std::vector<PblLibrary*>& libs, uint32_t workerCount, bool verb) :
+	libraries(libs), restarts(0), verbose(verb) {
+	if (workerCount == 0)
+		workerCount = std::max(1u, std::thread::hardware_concurrency());
+	Worker worker;
+	worker.pid = -1;
+	worker.fd = -1;
+	worker.inputIndex = -1;
+	workers.resize(workerCount, worker);
+}
+
+WorkerPool::~WorkerPool() {
+	for (auto itWorker = workers.begin(); itWorker != workers.end(); ++itWorker)
+		stopWorker(*itWorker, false);
+}
+
+void WorkerPool::setResultCacheFile(const std::string& path) {
+	cacheFile = path;
+}
+
+void WorkerPool::setBudget(const InputBudget::Limits& limits) {
+	budgetLimits = limits;
+}
+
+bool WorkerPool::startWorker(Worker& worker) {
+#ifdef WIN32
+	(void)worker;
+	return false;
+#else
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+		verbose && std::cerr << "Could not create worker socket: " << strerror(errno) << std::endl;
+		return false;
+	}
+
+	// nothing written to the output streams so far may be flushed twice
+	std::cout.flush();
+	std::cerr.flush();
+	pid_t pid = fork();
+	if (pid < 0) {
+		verbose && std::cerr << "Could not start worker: " << strerror(errno) << std::endl;
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		for (auto itWorker = workers.begin(); itWorker != workers.end(); ++itWorker) {
+			if (itWorker->fd >= 0)
+				close(itWorker->fd);
+		}
+		runWorker(fds[1]);
+	}
+
+	close(fds[1]);
+	worker.pid = pid;
+	worker.fd = fds[0];
+	worker.inputIndex = -1;
+	return true;
+#endif
+}
+
+void WorkerPool::stopWorker(Worker& worker, bool kill) {
+#ifndef WIN32
+	if (worker.fd >= 0)
+		close(worker.fd); // an idle worker sees the end of its requests and exits
+	if (worker.pid > 0) {
+		if (kill)
+			::kill(worker.pid, SIGKILL);
+		while (waitpid(worker.pid, nullptr, 0) < 0 && errno == EINTR)
+			;
+	}
+#endif
+	worker.pid = -1;
+	worker.fd = -1;
+	worker.inputIndex = -1;
+}
+
+void WorkerPool::runWorker(int fd) {
+#ifdef WIN32
+	(void)fd;
+#else
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+
+	// a cache of its own, file locks do not keep apart processes sharing one open file
+	ResultCache* cache = nullptr;
+	if (cacheFile != "") {
+		cache = new ResultCache();
+		if (!cache->open(cacheFile, verbose)) {
+			delete cache;
+			cache = nullptr;
+		}
+	}
+
+	BatchScanner scanner(libraries, 1, verbose);
+	scanner.setResultCache(cache);
+	scanner.setBudget(budgetLimits);
+	std::vector<std::string> inputs(1);
+	std::string response;
+	while (receiveMessage(fd, inputs[0])) {
+		scanner.scan(inputs, [&](uint32_t, BatchScanner::AppResult& result) {
+			response.clear();
+			appendLE32(response, static_cast<uint32_t>(result.binaries.size()));
+			for (auto itBinary = result.binaries.begin(); itBinary != result.binaries.end(); ++itBinary) {
+				uint32_t libraryIndex = 0;
+				while (strcmp(libraries[libraryIndex]->getPlatformName(), (*itBinary)->getPlatformName()) != 0)
+					libraryIndex++;
+				appendLE32(response, libraryIndex);
+				response.append(reinterpret_cast<const char*>((*itBinary)->getUUID()), 16);
+				appendLE32(response, (*itBinary)->getSdkVersion());
+				appendLE32(response, (*itBinary)->getUsedFunctionCount());
+				for (uint32_t i = 0; i < (*itBinary)->getUsedFunctionCount(); i++)
+					appendLE32(response, (*itBinary)->getUsedFunctionIndex(i));
+			}
+			appendLE32(response, static_cast<uint32_t>(result.errors.size()));
+			for (auto itError = result.errors.begin(); itError != result.errors.end(); ++itError) {
+				appendLE32(response, static_cast<uint32_t>(itError->size()));
+				response.append(*itError);
+			}
+		});
+		if (!sendMessage(fd, response))
+			break;
+	}
+	delete cache;
+	_exit(0); // the parent's streams and destructors are not ours
+#endif
+}
+
+bool WorkerPool::parseResult(const std::string& message, BatchScanner::AppResult& result) const {
+	const uint8_t* cur = reinterpret_cast<const uint8_t*>(message.data());
+	const uint8_t* end = cur + message.size();
+	auto readValue = [&](uint32_t& value) {
+		if (end - cur < 4)
+			return false;
+		value = readLE32(cur);
+		cur += 4;
+		return true;
+	};
+
+	uint32_t binaryCount, errorCount;
+	if (!readValue(binaryCount))
+		return false;
+	for (uint32_t i = 0; i < binaryCount; i++) {
+		uint32_t libraryIndex, sdkVersion, functionCount;
+		if (!readValue(libraryIndex) || end - cur < 16)
+			return false;
+		const uint8_t* uuid = cur;
+		cur += 16;
+		if (!readValue(sdkVersion) || !readValue(functionCount) || libraryIndex >= libraries.size() ||
+			functionCount > static_cast<size_t>(end - cur) / 4)
+			return false;
+		std::vector<uint32_t> functions(functionCount);
+		for (uint32_t j = 0; j < functionCount; j++) {
+			readValue(functions[j]);
+			if (functions[j] >= libraries[libraryIndex]->getFunctionCount())
+				return false;
+		}
+		result.binaries.push_back(new PblAppBinary(libraries[libraryIndex], functions, uuid, static_cast<uint16_t>(sdkVersion)));
+	}
+	if (!readValue(errorCount))
+		return false;
+	for (uint32_t i = 0; i < errorCount; i++) {
+		uint32_t size;
+		if (!readValue(size) || size > static_cast<size_t>(end - cur))
+			return false;
+		result.errors.push_back(std::string(reinterpret_cast<const char*>(cur), size));
+		cur += size;
+	}
+	return cur == end;
+}
+
+bool WorkerPool::dispatch(Worker& worker, uint32_t inputIndex, const std::string& input) {
+#ifdef WIN32
+	(void)worker;
+	(void)inputIndex;
+	(void)input;
+	return false;
+#else
+	if (!sendMessage(worker.fd, input))
+		return false;
+	worker.inputIndex = static_cast<int32_t>(inputIndex);
+	worker.started = std::chrono::steady_clock::now();
+	return true;
+#endif
+}
+
+void WorkerPool::scan(const std::vector<std::string>& inputs, const BatchScanner::ResultCallback& callback) {
+#ifdef WIN32
+	for (uint32_t i = 0; i < inputs.size(); i++) {
+		BatchScanner::AppResult result;
+		result.errors.push_back("Worker processes are not supported on windows");
+		callback(i, result);
+	}
+#else
+	for (auto itWorker = workers.begin(); itWorker != workers.end(); ++itWorker)
+		startWorker(*itWorker);
+
+	uint32_t nextInput = 0, finished = 0;
+	std::vector<pollfd> pollFds;
+	std::vector<Worker*> polledWorkers;
+	std::string message;
+	while (finished < inputs.size()) {
+		// idle workers get the next inputs, a worker that died while idle is replaced once
+		bool anyAlive = false;
+		for (auto itWorker = workers.begin(); itWorker != workers.end(); ++itWorker) {
+			if (itWorker->pid > 0 && itWorker->inputIndex < 0 && nextInput < inputs.size()) {
+				if (!dispatch(*itWorker, nextInput, inputs[nextInput])) {
+					stopWorker(*itWorker, true);
+					restarts++;
+					if (startWorker(*itWorker) && !dispatch(*itWorker, nextInput, inputs[nextInput]))
+						stopWorker(*itWorker, true);
+				}
+				if (itWorker->inputIndex >= 0)
+					nextInput++;
+			}
+			anyAlive |= itWorker->pid > 0;
+		}
+		// no input is in flight without a worker
+		if (!anyAlive) {
+			std::cerr << "No worker process is running" << std::endl;
+			for (; nextInput < inputs.size(); nextInput++) {
+				BatchScanner::AppResult result;
+				result.errors.push_back("Could not start worker process");
+				callback(nextInput, result);
+			}
+			break;
+		}
+
+		// the watchdog wakes up for the worker that runs out of time first
+		int timeout = -1;
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		pollFds.clear();
+		polledWorkers.clear();
+		for (auto itWorker = workers.begin(); itWorker != workers.end(); ++itWorker) {
+			if (itWorker->inputIndex < 0)
+				continue;
+			pollfd pollFd;
+			pollFd.fd = itWorker->fd;
+			pollFd.events = POLLIN;
+			pollFds.push_back(pollFd);
+			polledWorkers.push_back(&*itWorker);
+			if (budgetLimits.milliseconds > 0) {
+				auto deadline = itWorker->started + std::chrono::milliseconds(budgetLimits.milliseconds + WatchdogGraceMilliseconds);
+				int untilDeadline = std::max(0, static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count()) + 1);
+				if (timeout < 0 || untilDeadline < timeout)
+					timeout = untilDeadline;
+			}
+		}
+		if (poll(pollFds.data(), pollFds.size(), timeout) < 0 && errno != EINTR) {
+			std::cerr << "Could not wait for worker processes: " << strerror(errno) << std::endl;
+			break;
+		}
+
+		now = std::chrono::steady_clock::now();
+		for (uint32_t i = 0; i < pollFds.size(); i++) {
+			Worker& worker = *polledWorkers[i];
+			uint32_t inputIndex = static_cast<uint32_t>(worker.inputIndex);
+			BatchScanner::AppResult result;
+			if (pollFds[i].revents != 0) {
+				if (receiveMessage(worker.fd, message) && parseResult(message, result)) {
+					worker.inputIndex = -1;
+					finished++;
+					callback(inputIndex, result);
+					continue;
+				}
+
+				// the worker died in the middle of the input, or sent garbage
+				for (auto itBinary = result.binaries.begin(); itBinary != result.binaries.end(); ++itBinary)
+					delete *itBinary;
+				result.binaries.clear();
+				result.errors.clear();
+				int status = 0;
+				::kill(worker.pid, SIGKILL);
+				while (waitpid(worker.pid, &status, 0) < 0 && errno == EINTR)
+					;
+				worker.pid = -1;
+				std::string error = WIFSIGNALED(status) && WTERMSIG(status) != SIGKILL
+					? "Worker process crashed with signal " + std::to_string(WTERMSIG(status))
+					: std::string("Worker process failed");
+				verbose && std::cerr << error << " on \"" << inputs[inputIndex] << "\"" << std::endl;
+				result.errors.push_back(error);
+			}
+			else if (budgetLimits.milliseconds > 0 &&
+				now - worker.started > std::chrono::milliseconds(budgetLimits.milliseconds + WatchdogGraceMilliseconds)) {
+				verbose && std::cerr << "Killing worker process stuck on \"" << inputs[inputIndex] << "\"" << std::endl;
+				result.errors.push_back("Budget exceeded: worker process killed after " + std::to_string(budgetLimits.milliseconds) + " ms");
+			}
+			else
+				continue;
+
+			stopWorker(worker, true);
+			restarts++;
+			startWorker(worker);
+			finished++;
+			callback(inputIndex, result);
+		}
+	}
+
+	for (auto itWorker = workers.begin(); itWorker != workers.end(); ++itWorker)
+		stopWorker(*itWorker, false);
+	verbose && restarts > 0 && std::cerr << "Restarted " << restarts << " worker processes" << std::endl;
+#endif
+}
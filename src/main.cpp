@@ -1,11 +1,24 @@
 #include "pbw_api_info.h"
+#include "../thirdparty/json11/json11.hpp"
 
 #include <iostream>
 #include <string>
 #include <algorithm>
+#include <thread>
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#ifdef WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
 
 #define INDENT_CHARACTER ' '
 #define INDENT_WIDTH 2
@@ -32,10 +45,38 @@ struct ProgramArguments {
 	std::string sdkroot = "";
 #endif
 	bool defaultSdkroot = true;
+	std::vector<std::string> mapSdkroots; // only add their functions to the function map
 	bool mapLibFunctions = false;
 	bool outputSymbolOffsets = false;
+	bool metadataOnly = false;
+	bool stdinStream = false;
+	bool bundle = false;
+	bool batch = false;
+	bool ndjson = false;
+	bool compact = false;
+	bool aggregate = false;
+	bool decode = false;
+	bool watch = false;
+	bool merge = false;
+	uint32_t shardIndex = 0;
+	uint32_t shardCount = 0; // 0 means the batch is not sharded
+	uint32_t debounce = 500; // milliseconds a watched pbw has to be unchanged
+	uint32_t jobs = 0; // 0 means one per core
+	uint32_t workers = 0; // 0 means threads instead of worker processes
+	bool pipeline = false;
+	BatchPipeline::Config pipelineConfig;
 	std::string inputFile = "null";
+	std::vector<std::string> inputFiles; // batch inputs
+	std::string inputList; // batch input list file
+	std::vector<std::string> includes; // globs for the files in input directories
+	std::vector<std::string> excludes;
 	std::string outputFile; // if "" then output to stdout
+	int outputCompression = -1; // gzip level, -1 writes uncompressed output
+	std::string serveSocket; // unix socket path of the daemon mode
+	std::string cacheFile; // if "" then every binary is scanned
+	std::string journalFile; // if "" then an interrupted batch has to start over
+	InputBudget::Limits budget; // for every input
+	bool resume = false;
 	std::string libPath[ArgPlatformCount];
 };
 
@@ -47,14 +88,55 @@ struct ProgramArgumentParser {
 
 void printHelp() {
 	std::cerr
-		<< "usage: pbw_api_info [options] [inputfile|'null'] [outputfile]" << std::endl << std::endl
+		<< "usage: pbw_api_info [options] [inputfile|'-'|'null'] [outputfile]" << std::endl
+		<< "       pbw_api_info --batch [options] [-o outputfile] [inputs...]" << std::endl
+		<< "       pbw_api_info --merge [-o outputfile] [partial results...]" << std::endl
+		<< "       pbw_api_info --merge --aggregate [-o outputfile] [reports...]" << std::endl
+		<< "       pbw_api_info --decode [--map-lib-functions] [--symbol-offset] [-o outputfile] compactfile" << std::endl
+#ifdef __linux__
+		<< "       pbw_api_info --watch [options] [-o outputfile] [directories...]" << std::endl
+#endif
+		<< std::endl
 		<< "options:" << std::endl
 		<< "  -h --help             -> Shows this help screen and exits the program" << std::endl
 		<< "  --sdkroot             -> Sets the path of the *core* sdk" << std::endl
 		<< "  --libpath-<platform>  -> Sets the path of a single platform import library" << std::endl
 		<< "    <platform> may be: aplite, basalt, diorite, chalk, emery" << std::endl
 		<< "  --map-lib-functions   -> Outputs all functions of the libraries" << std::endl
+		<< "  --map-sdkroot <dir>   -> Adds the functions of another core sdk to the function map (repeatable)" << std::endl
 		<< "  --symbol-offset       -> Outputs functions as their symbol table offset" << std::endl
+		<< "  --metadata            -> Outputs app headers and appinfo.json without scanning" << std::endl
+		<< "  --stdin-stream        -> Reads length prefixed pbws from stdin (input has to be '-')" << std::endl
+		<< "  --bundle              -> Input is a zip or tar file containing pbws" << std::endl
+		<< "  --batch               -> Scans every input file and every pbw in input directories" << std::endl
+		<< "  --input-list          -> Reads batch inputs from a newline or NUL separated file ('-' is stdin)" << std::endl
+		<< "  --include <glob>      -> Scans only files in input directories matching the glob (default: *.pbw)" << std::endl
+		<< "  --exclude <glob>      -> Skips files and directories in input directories matching the glob" << std::endl
+		<< "  -j --jobs             -> Number of threads for batch scanning (default: one per core)" << std::endl
+		<< "  --workers <n>         -> Scans batch inputs in n forked processes, a crash only fails one input (0: one per core)" << std::endl
+		<< "  --shard <i>/<n>       -> Scans only the batch inputs of shard i (0 based) of n and writes a partial result" << std::endl
+		<< "  --merge               -> Combines the partial results of all shards into one result" << std::endl
+		<< "  --pipeline=<r>,<i>,<s> -> Scans batch inputs in stages with <r> read, <i> inflate and <s> scan threads" << std::endl
+		<< "  --prefetch=<mode>     -> Reads whole batch inputs ahead in the pipeline, <mode> may be: uring, pread" << std::endl
+		<< "  -o --output           -> Sets the output file in batch mode" << std::endl
+		<< "  --ndjson              -> Writes one JSON line per batch input as soon as it is scanned" << std::endl
+		<< "  --output-compress[=<level>] -> Writes the output gzip compressed (level 0 to 10, default: 6)" << std::endl
+		<< "  --compact             -> Appends batch results to the output file in the compact binary format" << std::endl
+		<< "  --decode              -> Converts a compact result file into JSON" << std::endl
+		<< "  --aggregate           -> Outputs how many batch inputs use each API, with --merge adds up such reports" << std::endl
+#ifndef WIN32
+		<< "  --serve <socket>      -> Keeps the libraries loaded and answers scan requests on a unix socket" << std::endl
+#endif
+#ifdef __linux__
+		<< "  --watch               -> Scans pbws in the directories whenever they are created or changed" << std::endl
+		<< "  --debounce <ms>       -> Time a watched pbw has to be unchanged before it is scanned (default: 500)" << std::endl
+#endif
+		<< "  --cache <file>        -> Reuses scan results of identical binaries, new results are added to the file" << std::endl
+		<< "  --max-inflated <size> -> Gives up on inputs whose binaries are larger (k, m and g suffixes)" << std::endl
+		<< "  --max-time <ms>       -> Gives up on inputs that take longer to extract and scan" << std::endl
+		<< "  --max-scan <size>     -> Gives up on inputs with more binary bytes to search (k, m and g suffixes)" << std::endl
+		<< "  --journal <file>      -> Records the finished batch inputs, so an interrupted batch can be resumed" << std::endl
+		<< "  --resume              -> Continues the batch of the journal, finished inputs are not scanned again" << std::endl
 		<< "  -v --verbose          -> Prints detailed progress information to stderr" << std::endl
 		<< std::endl;
 }
@@ -71,11 +153,12 @@ bool isValueArgument(ProgramArgumentParser& parser, const char* testArg, std::st
 		curArg += strlen(testArg);
 
 		// confirm <testArg> <value>
-		if (curArg[0] == '\0' && parser.argi < parser.argc && *parser.argv[parser.argi] != '-')
+		const char* nextArg = parser.argi < parser.argc ? parser.argv[parser.argi] : nullptr;
+		if (curArg[0] == '\0' && nextArg != nullptr && (nextArg[0] != '-' || nextArg[1] == '\0')) // '-' is stdin
 			value.assign(parser.argv[parser.argi++]);
 		// confirm <testArg>=<value>
 		else if (curArg[0] == '=' && curArg[1] != '\0')
-			value.assign(curArg + 2);
+			value.assign(curArg + 1);
 		else
 			std::cerr << "expected a value for option \"" << testArg << "\"" << std::endl;
 		
@@ -85,6 +168,61 @@ bool isValueArgument(ProgramArgumentParser& parser, const char* testArg, std::st
 		return false;
 }
 
+/**
+ * parses a byte count with an optional k, m or g suffix (powers of 1024)
+ */
+bool parseSize(const std::string& value, uint64_t& size) {
+	if (value.empty() || !isdigit(static_cast<unsigned char>(value[0])))
+		return false;
+	char* end;
+	errno = 0;
+	size = strtoull(value.c_str(), &end, 10);
+	if (errno == ERANGE)
+		return false;
+	const char* suffixes = "kmg";
+	const char* suffix = *end != '\0' ? strchr(suffixes, tolower(*end)) : nullptr;
+	if (suffix != nullptr) {
+		int shift = 10 * static_cast<int>(suffix - suffixes + 1);
+		if (size > (UINT64_MAX >> shift))
+			return false;
+		size <<= shift;
+		end++;
+	}
+	return *end == '\0';
+}
+
+bool parseMilliseconds(const std::string& value, uint32_t& milliseconds) {
+	if (value.empty() || !isdigit(static_cast<unsigned char>(value[0])))
+		return false;
+	char* end;
+	errno = 0;
+	unsigned long long parsed = strtoull(value.c_str(), &end, 10);
+	if (errno == ERANGE || *end != '\0' || parsed > UINT32_MAX)
+		return false;
+	milliseconds = static_cast<uint32_t>(parsed);
+	return true;
+}
+
+/**
+ * parses "<read>,<inflate>,<scan>" thread counts, missing or zero counts keep their default
+ */
+bool parsePipelineConfig(const std::string& value, BatchPipeline::Config& config) {
+	uint32_t* counts[] = { &config.readThreads, &config.inflateThreads, &config.scanThreads };
+	const char* cur = value.c_str();
+	for (int i = 0; i < 3 && *cur != '\0'; i++) {
+		char* end;
+		unsigned long count = strtoul(cur, &end, 10);
+		if (end != cur)
+			*counts[i] = static_cast<uint32_t>(count);
+		if (*end == ',')
+			end++;
+		else if (*end != '\0')
+			return false;
+		cur = end;
+	}
+	return *cur == '\0';
+}
+
 /**
  * takes the console arguments and parses them into the ProgramArguments structure
  * @returns true if the program should continue
@@ -104,7 +242,11 @@ bool parseArguments(ProgramArguments& args, int argc, char* argv[]) {
 	// Read options
 	while (parser.argi < parser.argc) {
 		const char* curArg = parser.argv[parser.argi++];
-		if (curArg[0] != '-') {
+		if (curArg[0] != '-' || curArg[1] == '\0') { // '-' is stdin
+			if (args.batch || args.watch || args.merge || args.decode) { // options and inputs can be mixed in these modes
+				args.inputFiles.push_back(curArg);
+				continue;
+			}
 			parser.argi--; // we did not consume it
 			break;
 		}
@@ -130,14 +272,195 @@ bool parseArguments(ProgramArguments& args, int argc, char* argv[]) {
 			args.libPath[ArgPlatform_Emery] = optionValue;
 		else if (strcmp(curArg, "--map-lib-functions") == 0)
 			args.mapLibFunctions = true;
+		else if (isValueArgument(parser, "--map-sdkroot", optionValue))
+			args.mapSdkroots.push_back(optionValue);
 		else if (strcmp(curArg, "--symbol-offset") == 0)
 			args.outputSymbolOffsets = true;
+		else if (strcmp(curArg, "--metadata") == 0)
+			args.metadataOnly = true;
+		else if (strcmp(curArg, "--stdin-stream") == 0)
+			args.stdinStream = true;
+		else if (strcmp(curArg, "--bundle") == 0)
+			args.bundle = true;
+		else if (strcmp(curArg, "--batch") == 0)
+			args.batch = true;
+		else if (strcmp(curArg, "--merge") == 0)
+			args.merge = true;
+		else if (isValueArgument(parser, "--shard", optionValue)) {
+			char* end;
+			args.shardIndex = static_cast<uint32_t>(strtoul(optionValue.c_str(), &end, 10));
+			args.shardCount = *end == '/' ? static_cast<uint32_t>(strtoul(end + 1, &end, 10)) : 0;
+			if (*end != '\0' || args.shardCount == 0 || args.shardIndex >= args.shardCount) {
+				std::cerr << "expected <index>/<count> with index < count for option \"--shard\"" << std::endl;
+				return false;
+			}
+		}
+		else if (strcmp(curArg, "--watch") == 0)
+			args.watch = true;
+		else if (isValueArgument(parser, "--debounce", optionValue))
+			args.debounce = static_cast<uint32_t>(strtoul(optionValue.c_str(), nullptr, 10));
+		else if (strcmp(curArg, "--ndjson") == 0)
+			args.ndjson = true;
+		else if (strcmp(curArg, "--output-compress") == 0)
+			args.outputCompression = MZ_DEFAULT_LEVEL;
+		else if (strncmp(curArg, "--output-compress=", 18) == 0) {
+			char* end;
+			args.outputCompression = static_cast<int>(strtol(curArg + 18, &end, 10));
+			if (*end != '\0' || end == curArg + 18 || args.outputCompression < 0 || args.outputCompression > MZ_UBER_COMPRESSION) {
+				std::cerr << "expected a level from 0 to 10 for option \"--output-compress\"" << std::endl;
+				return false;
+			}
+		}
+		else if (strcmp(curArg, "--compact") == 0)
+			args.compact = true;
+		else if (strcmp(curArg, "--decode") == 0)
+			args.decode = true;
+		else if (strcmp(curArg, "--aggregate") == 0)
+			args.aggregate = true;
+		else if (isValueArgument(parser, "--input-list", optionValue))
+			args.inputList = optionValue;
+		else if (isValueArgument(parser, "--include", optionValue))
+			args.includes.push_back(optionValue);
+		else if (isValueArgument(parser, "--exclude", optionValue))
+			args.excludes.push_back(optionValue);
+		else if (isValueArgument(parser, "--workers", optionValue)) {
+#ifdef WIN32
+			std::cerr << "--workers is not supported on windows" << std::endl;
+			return false;
+#endif
+			args.workers = static_cast<uint32_t>(strtoul(optionValue.c_str(), nullptr, 10));
+			if (args.workers == 0)
+				args.workers = std::max(1u, std::thread::hardware_concurrency());
+		}
+		else if (isValueArgument(parser, "--jobs", optionValue) || isValueArgument(parser, "-j", optionValue))
+			args.jobs = static_cast<uint32_t>(strtoul(optionValue.c_str(), nullptr, 10));
+		else if (isValueArgument(parser, "--output", optionValue) || isValueArgument(parser, "-o", optionValue))
+			args.outputFile = optionValue;
+		else if (isValueArgument(parser, "--pipeline", optionValue)) {
+			if (!parsePipelineConfig(optionValue, args.pipelineConfig)) {
+				std::cerr << "expected thread counts like \"1,2,4\" for option \"--pipeline\"" << std::endl;
+				return false;
+			}
+			args.pipeline = true;
+		}
+		else if (isValueArgument(parser, "--cache", optionValue))
+			args.cacheFile = optionValue;
+		else if (isValueArgument(parser, "--max-inflated", optionValue) || isValueArgument(parser, "--max-scan", optionValue)) {
+			bool inflated = strstr(curArg, "--max-inflated") == curArg;
+			if (!parseSize(optionValue, inflated ? args.budget.inflatedSize : args.budget.scanBytes)) {
+				std::cerr << "expected a size like \"64m\" for option \"" << (inflated ? "--max-inflated" : "--max-scan") << "\"" << std::endl;
+				return false;
+			}
+		}
+		else if (isValueArgument(parser, "--max-time", optionValue)) {
+			if (!parseMilliseconds(optionValue, args.budget.milliseconds)) {
+				std::cerr << "expected milliseconds like \"500\" for option \"--max-time\"" << std::endl;
+				return false;
+			}
+		}
+		else if (isValueArgument(parser, "--journal", optionValue))
+			args.journalFile = optionValue;
+		else if (strcmp(curArg, "--resume") == 0)
+			args.resume = true;
+		else if (isValueArgument(parser, "--serve", optionValue))
+			args.serveSocket = optionValue;
+		else if (isValueArgument(parser, "--prefetch", optionValue)) {
+			if (optionValue == "uring")
+				args.pipelineConfig.prefetchMode = CorpusReader::Mode_Uring;
+			else if (optionValue == "pread")
+				args.pipelineConfig.prefetchMode = CorpusReader::Mode_Pread;
+			else {
+				std::cerr << "expected \"uring\" or \"pread\" for option \"--prefetch\"" << std::endl;
+				return false;
+			}
+			args.pipelineConfig.prefetch = true;
+			args.pipeline = true;
+		}
 		else {
 			std::cerr << "unknown option \"" << curArg << "\"" << std::endl;
 			return false;
 		}
 	}
 
+	// Metadata is read for a single input, a batch or a stream, nothing is scanned
+	if (args.metadataOnly && (args.serveSocket != "" || args.watch || args.merge || args.decode || args.bundle || args.compact || args.aggregate || args.journalFile != "")) {
+		std::cerr << "--metadata can not be combined with --serve, --watch, --merge, --decode, --bundle, --compact, --aggregate or --journal" << std::endl;
+		return false;
+	}
+
+	// Requests bring their own inputs
+	if (args.serveSocket != "") {
+		if (args.outputCompression >= 0) {
+			std::cerr << "--output-compress can not be combined with --serve" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	// Partial results are already read
+	if (args.merge) {
+		if (args.inputFiles.empty()) {
+			std::cerr << (args.aggregate ? "expected reports to merge" : "expected partial results to merge") << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	// The compact result file is already read
+	if (args.decode) {
+		if (args.inputFiles.size() != 1) {
+			std::cerr << "expected one compact result file to decode" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	// Watched directories are already read
+	if (args.watch) {
+		if (args.inputFiles.empty()) {
+			std::cerr << "expected directories to watch" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	// Batch inputs are already read
+	if (args.batch) {
+		if (args.inputFiles.empty() && args.inputList == "") {
+			std::cerr << "expected input paths or an input list" << std::endl;
+			return false;
+		}
+		if (args.workers > 0 && args.pipeline) {
+			std::cerr << "--workers can not be combined with --pipeline" << std::endl;
+			return false;
+		}
+		if (args.resume && args.journalFile == "") {
+			std::cerr << "--resume expects a journal" << std::endl;
+			return false;
+		}
+		if (args.journalFile != "" && args.ndjson && args.outputFile == "") {
+			std::cerr << "--journal with --ndjson expects an output file" << std::endl;
+			return false;
+		}
+		if (args.compact && (args.outputFile == "" || args.ndjson || args.journalFile != "" || args.outputCompression >= 0)) {
+			std::cerr << "--compact expects an output file and can not be combined with --ndjson, --journal or --output-compress" << std::endl;
+			return false;
+		}
+		if (args.aggregate && (args.ndjson || args.compact || args.journalFile != "")) {
+			std::cerr << "--aggregate can not be combined with --ndjson, --compact or --journal" << std::endl;
+			return false;
+		}
+		if (args.journalFile != "" && args.ndjson && args.outputCompression >= 0) {
+			std::cerr << "--journal with --ndjson can not be combined with --output-compress" << std::endl;
+			return false;
+		}
+		if (args.journalFile != "" && args.shardCount > 0 && !args.ndjson) {
+			std::cerr << "--journal does not support partial results, use --ndjson" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
 	// Read input/output paths
 	if (parser.argi >= parser.argc) {
 		if (!args.mapLibFunctions) {
@@ -147,6 +470,10 @@ bool parseArguments(ProgramArguments& args, int argc, char* argv[]) {
 		return true;
 	}
 	args.inputFile.assign(parser.argv[parser.argi++]);
+	if (args.stdinStream && args.inputFile != "-") {
+		std::cerr << "--stdin-stream expects '-' as input file" << std::endl;
+		return false;
+	}
 
 	if (parser.argi < parser.argc)
 		args.outputFile.assign(parser.argv[parser.argi++]);
@@ -163,10 +490,10 @@ bool parseArguments(ProgramArguments& args, int argc, char* argv[]) {
  */
 
 struct Platform {
-	ArArchive libArchive;
 	PblLibrary library;
+	bool mappingOnly; // a library of another sdk that is only part of the function map
 
-	Platform(const char* name) : library(name) {
+	Platform(const char* name, bool mapping, StringPool& functionNames) : library(name, &functionNames), mappingOnly(mapping) {
 	}
 };
 typedef std::vector<Platform*> PlatformList;
@@ -174,21 +501,25 @@ typedef std::vector<Platform*> PlatformList;
 PlatformList::iterator findPlatform(PlatformList& platforms, const char* name) {
 	auto itPlatform = platforms.begin();
 	for (; itPlatform != platforms.end(); ++itPlatform) {
-		if (strcmp((*itPlatform)->library.getPlatformName(), name) == 0)
+		if (!(*itPlatform)->mappingOnly && strcmp((*itPlatform)->library.getPlatformName(), name) == 0)
 			return itPlatform;
 	}
 	return platforms.end();
 }
 
-bool loadPlatform(PlatformList& platforms, const char* platformName, const char* filename, bool verbose) {
-	if (findPlatform(platforms, platformName) != platforms.end())
+bool loadPlatform(PlatformList& platforms, StringPool& functionNames, const char* platformName, const char* filename, bool verbose, bool mappingOnly = false) {
+	if (!mappingOnly && findPlatform(platforms, platformName) != platforms.end())
 		return false;
 
-	Platform* platform = new Platform(platformName);
-	if (!platform->libArchive.load(filename))
-		return false;
-	if (!platform->library.loadFromArArchive(platform->libArchive, verbose))
-		return false;
+	// the library copies what it needs, the archive is released right away
+	Platform* platform = new Platform(platformName, mappingOnly, functionNames);
+	{
+		ArArchive libArchive;
+		if (!libArchive.load(filename) || !platform->library.loadFromArArchive(libArchive, verbose)) {
+			delete platform;
+			return false;
+		}
+	}
 	platforms.push_back(platform);
 
 	return true;
@@ -222,6 +553,35 @@ bool isFile(const char* filename) {
 		return (s.st_mode & S_IFREG) > 0;
 }
 
+// reads a list of paths separated by NUL characters or, if there are none, by newlines
+bool readInputList(const std::string& path, std::vector<std::string>& inputs) {
+	FILE* fp = path == "-" ? stdin : fopen(path.c_str(), "rb");
+	if (fp == nullptr)
+		return false;
+	std::string list;
+	char buffer[4096];
+	size_t readSize;
+	while ((readSize = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+		list.append(buffer, readSize);
+	if (fp != stdin)
+		fclose(fp);
+
+	char separator = list.find('\0') != std::string::npos ? '\0' : '\n';
+	size_t start = 0;
+	while (start < list.length()) {
+		size_t end = list.find(separator, start);
+		if (end == std::string::npos)
+			end = list.length();
+		std::string input = list.substr(start, end - start);
+		if (!input.empty() && input[input.length() - 1] == '\r')
+			input.erase(input.length() - 1);
+		if (!input.empty())
+			inputs.push_back(input);
+		start = end + 1;
+	}
+	return true;
+}
+
 // cares about unix/windows path variants
 std::string joinPath(const std::string& base, const char* spec) {
 	std::string result = base;
@@ -249,222 +609,1706 @@ std::string joinPath(const std::string& base, const char* spec) {
 	return result;
 }
 
+// @returns false if the sdk has no library
+bool loadSdkPlatforms(PlatformList& platforms, StringPool& functionNames, const std::string& sdkRoot, bool mappingOnly, bool verbose) {
+	bool foundSomeLib = false;
+	std::string libDirPath = joinPath(sdkRoot, "pebble/");
+	for (int i = 0; i < ArgPlatformCount; i++) {
+		std::string libPath = joinPath(libDirPath, PlatformNames[i]);
+		libPath = joinPath(libPath, "lib/libpebble.a");
+		if (isFile(libPath.c_str())) {
+			foundSomeLib = true;
+
+			loadPlatform(platforms, functionNames, PlatformNames[i], libPath.c_str(), verbose, mappingOnly);
+		}
+	}
+	return foundSomeLib;
+}
+
+/**
+ * loads the overwritten library paths first and every other platform from the SDK root
+ * the libraries of the map SDK roots follow, they are only part of the function map
+ * all libraries intern their function names in functionNames, which has to outlive them
+ * @returns false if not a single library to scan with could be loaded
+ */
+bool loadPlatforms(PlatformList& platforms, StringPool& functionNames, const ProgramArguments& args) {
+	// Load from overwritten library paths
+	for (int i = 0; i < ArgPlatformCount; i++) {
+		if (args.libPath[i] != "") {
+			if (!isFile(args.libPath[i].c_str()))
+				std::cerr << "Could not open library for " << PlatformNames[i] << std::endl;
+			else if (!loadPlatform(platforms, functionNames, PlatformNames[i], args.libPath[i].c_str(), args.verbose))
+				std::cerr << "Could not load library for " << PlatformNames[i] << std::endl;
+		}
+	}
+
+	// Load from SDK root
+	if (args.sdkroot != "") {
+		std::string sdkRoot = joinPath(args.sdkroot, nullptr);
+		if (!isDirectory(sdkRoot.c_str())) {
+			if (args.defaultSdkroot)
+				args.verbose && std::cerr << "Could not find any installed core sdk" << std::endl;
+			else
+				std::cerr << "Could not find specified core sdk" << std::endl;
+		}
+		else if (!loadSdkPlatforms(platforms, functionNames, sdkRoot, false, args.verbose) && args.verbose)
+			std::cerr << "Could not load any libraries from core sdk" << std::endl;
+	}
+	bool loaded = platforms.size() > 0;
+
+	for (auto itSdkroot = args.mapSdkroots.begin(); itSdkroot != args.mapSdkroots.end(); ++itSdkroot) {
+		std::string sdkRoot = joinPath(*itSdkroot, nullptr);
+		if (!isDirectory(sdkRoot.c_str()) || !loadSdkPlatforms(platforms, functionNames, sdkRoot, true, args.verbose))
+			std::cerr << "Could not load any libraries from core sdk \"" << *itSdkroot << "\"" << std::endl;
+	}
+
+	return loaded;
+}
+
+/**
+ * Input helper
+ */
+
+// reads a whole stream, the buffer is reused to avoid reallocations
+bool readWholeStream(FILE* stream, std::vector<uint8_t>& buffer) {
+	const size_t chunkSize = 64 * 1024;
+	size_t size = 0;
+	while (true) {
+		if (buffer.size() < size + chunkSize)
+			buffer.resize(size + chunkSize);
+		size_t readSize = fread(buffer.data() + size, 1, chunkSize, stream);
+		size += readSize;
+		if (readSize < chunkSize)
+			break;
+	}
+	buffer.resize(size);
+	return !ferror(stream);
+}
+
+// the largest pbw that is received in memory, --max-inflated only limits the binaries inside
+static constexpr uint64_t MaxInlineInputSize = 256 * 1024 * 1024;
+
+// reads and drops size bytes, stdin is usually a pipe that cannot seek
+bool skipBytes(FILE* stream, uint64_t size) {
+	char buffer[64 * 1024];
+	while (size > 0) {
+		size_t chunk = static_cast<size_t>(std::min<uint64_t>(size, sizeof(buffer)));
+		if (fread(buffer, 1, chunk, stream) != chunk)
+			return false;
+		size -= chunk;
+	}
+	return true;
+}
+
+/**
+ * reads the next frame of a length prefixed stream: an 8 byte little endian size followed by the data
+ * returns false at the end of the stream, truncated is set if the stream ended inside a frame
+ * tooLarge is set for a frame above maxSize, its data is skipped and the buffer left empty
+ */
+bool readStreamFrame(FILE* stream, std::vector<uint8_t>& buffer, uint64_t maxSize, bool& truncated, bool& tooLarge) {
+	tooLarge = false;
+	uint8_t prefix[8];
+	size_t prefixSize = fread(prefix, 1, sizeof(prefix), stream);
+	truncated = prefixSize > 0 && prefixSize < sizeof(prefix);
+	if (prefixSize != sizeof(prefix))
+		return false;
+
+	uint64_t frameSize = 0;
+	for (int i = 7; i >= 0; i--)
+		frameSize = (frameSize << 8) | prefix[i];
+	if (frameSize > maxSize) {
+		tooLarge = true;
+		buffer.clear();
+		truncated = !skipBytes(stream, frameSize);
+		return !truncated;
+	}
+	buffer.resize(static_cast<size_t>(frameSize));
+	truncated = fread(buffer.data(), 1, buffer.size(), stream) != buffer.size();
+	return !truncated;
+}
+
+void setBinaryStdin() {
+#ifdef WIN32
+	_setmode(_fileno(stdin), _O_BINARY);
+#endif
+}
+
 /**
  * Output helper
  */
-void outputIndent(std::ostream& output, uint32_t indent) {
-	while (indent-- > 0)
-		output << INDENT_CHARACTER;
+// if no output file is given the output goes to stdout
+bool openOutput(JsonWriter& output, const ProgramArguments& args) {
+	if (output.open(args.outputFile, args.outputCompression, args.jobs))
+		return true;
+	std::cerr << "Could not open output file" << std::endl;
+	return false;
 }
 
-void outputBinary(std::ostream& output, PblAppBinary* binary, uint32_t indent, bool asSymbolOffset) {
-	output << "{" << std::endl;
+void outputIndent(JsonWriter& output, uint32_t indent) {
+	output.writeRepeated(INDENT_CHARACTER, indent);
+}
+
+// Binary is a PblAppBinary or a binary read from a compact result file
+template<typename Binary>
+void outputBinary(JsonWriter& output, const Binary* binary, uint32_t indent, bool asSymbolOffset) {
+	output << "{" << '\n';
 	outputIndent(output, indent + INDENT_WIDTH);
-	output << "\"usedAPIs\": [" << std::endl;
+	output << "\"usedAPIs\": [" << '\n';
 	for (uint32_t i = 0; i < binary->getUsedFunctionCount(); i++) {
 		if (i > 0)
-			output << "," << std::endl;
+			output << "," << '\n';
 		outputIndent(output, indent + 2*INDENT_WIDTH);
 		if (asSymbolOffset)
 			output << binary->getUsedFunctionSymbolTableOffset(i);
 		else
 			output << "\"" << binary->getUsedFunctionName(i) << "\"";
 	}
-	output << std::endl;
+	output << '\n';
 	outputIndent(output, indent + INDENT_WIDTH);
-	output << "]" << std::endl;
+	output << "]" << '\n';
 	outputIndent(output, indent);
 	output << "}";
 }
 
-void outputFunctions(std::ostream& output, PlatformList& platforms, uint32_t indent) {
-	// merge platforms
-	std::vector<std::vector<std::string>> functions; // symbol table with array of function names
-	auto itPlatform = platforms.begin();
-	for (; itPlatform != platforms.end(); ++itPlatform) {
-		for (uint32_t i = 0; i < (*itPlatform)->library.getFunctionCount(); i++) {
-			uint32_t symbolTableOff = (*itPlatform)->library.getFunctionSymbolTableOffset(i);
-			std::string funcName = (*itPlatform)->library.getFunctionName(i);
-			if (symbolTableOff == UINT32_MAX)
-				continue;
-			functions.resize(symbolTableOff + 1);
+template<typename Binary>
+void outputPlatforms(JsonWriter& output, const std::vector<Binary*>& binaries, uint32_t indent, bool asSymbolOffset) {
+	output << "{" << '\n';
+	for (uint32_t i = 0; i < binaries.size(); i++) {
+		if (i > 0)
+			output << "," << '\n';
+		outputIndent(output, indent + INDENT_WIDTH);
+		output << "\"" << binaries[i]->getPlatformName() << "\": ";
+		outputBinary(output, binaries[i], indent + INDENT_WIDTH, asSymbolOffset);
+	}
+	output << '\n';
+	outputIndent(output, indent);
+	output << "}";
+}
 
-			uint32_t j;
-			for (j = 0; j < functions[symbolTableOff].size(); j++) {
-				if (functions[symbolTableOff][j] == funcName)
-					break;
-			}
-			if (j >= functions[symbolTableOff].size())
-				functions[symbolTableOff].push_back(funcName);
+// merge platforms, the table is sized once for all libraries
+void libraryFunctions(PlatformList& platforms, FunctionMap& functions) {
+	uint32_t symbolTableSize = 0;
+	size_t functionCount = 0;
+	for (auto itPlatform = platforms.begin(); itPlatform != platforms.end(); ++itPlatform) {
+		const PblLibrary& library = (*itPlatform)->library;
+		for (uint32_t i = 0; i < library.getFunctionCount(); i++) {
+			uint32_t symbolTableOff = library.getFunctionSymbolTableOffset(i);
+			if (symbolTableOff != UINT32_MAX)
+				symbolTableSize = std::max(symbolTableSize, symbolTableOff + 1);
 		}
+		functionCount += library.getFunctionCount();
 	}
+	functions.reserve(symbolTableSize, functionCount);
+	for (auto itPlatform = platforms.begin(); itPlatform != platforms.end(); ++itPlatform)
+		functions.addLibrary((*itPlatform)->library);
+	functions.finish();
+}
 
-	// output
-	output << "[" << std::endl;
-	auto itFunction = functions.begin();
-	for (; itFunction != functions.end(); ++itFunction) {
-		if (itFunction != functions.begin())
-			output << "," << std::endl;
+void outputFunctions(JsonWriter& output, const FunctionMap& functions, uint32_t indent) {
+	output << "[" << '\n';
+	for (uint32_t symbolTableOff = 0; symbolTableOff < functions.getSymbolTableSize(); symbolTableOff++) {
+		if (symbolTableOff > 0)
+			output << "," << '\n';
 		outputIndent(output, indent + INDENT_WIDTH);
 		
-		if (itFunction->size() == 0)
+		uint32_t nameCount = functions.getNameCount(symbolTableOff);
+		if (nameCount == 0)
 			output << "[]";
-		else if (itFunction->size() == 1)
-			output << "\"" << itFunction->at(0) << "\"";
+		else if (nameCount == 1)
+			output << "\"" << functions.getName(symbolTableOff, 0) << "\"";
 		else {
-			output << "[" << std::endl;
-			for (uint32_t i = 0; i < itFunction->size(); i++) {
+			output << "[" << '\n';
+			for (uint32_t i = 0; i < nameCount; i++) {
 				if (i > 0)
-					output << "," << std::endl;
+					output << "," << '\n';
 				outputIndent(output, indent + 2 * INDENT_WIDTH);
-				output << "\"" << itFunction->at(i) << "\"";
+				output << "\"" << functions.getName(symbolTableOff, i) << "\"";
 			}
-			output << std::endl;
+			output << '\n';
 			outputIndent(output, indent + INDENT_WIDTH);
 			output << "]";
 		}
 	}
-	output << std::endl;
+	output << '\n';
 	outputIndent(output, indent);
 	output << "]";
 }
 
 /**
- * The entrypoint to this program
+ * Metadata output
  */
-int main(int argc, char* argv[]) {
-	ProgramArguments args;
-	if (!parseArguments(args, argc, argv))
-		return 1;
-	if (args.inputFile == "null" && !args.mapLibFunctions) {
-		std::cerr << "Nothing to do." << std::endl;
-		return 6;
+std::string headerString(const char* str, size_t maxLen) {
+	size_t len = 0;
+	while (len < maxLen && str[len] != '\0')
+		len++;
+	return std::string(str, len);
+}
+
+std::string headerVersion(uint8_t major, uint8_t minor) {
+	return std::to_string(major) + "." + std::to_string(minor);
+}
+
+std::string hexString(const uint8_t* data, size_t size) {
+	static const char* hexDigits = "0123456789abcdef";
+	std::string result;
+	for (size_t i = 0; i < size; i++) {
+		result += hexDigits[data[i] >> 4];
+		result += hexDigits[data[i] & 0xf];
 	}
+	return result;
+}
 
-	PlatformList platforms;
+std::string headerUUID(const uint8_t* uuid) {
+	static const char* hexDigits = "0123456789abcdef";
+	std::string result;
+	for (int i = 0; i < 16; i++) {
+		if (i == 4 || i == 6 || i == 8 || i == 10)
+			result += '-';
+		result += hexDigits[uuid[i] >> 4];
+		result += hexDigits[uuid[i] & 0xf];
+	}
+	return result;
+}
 
-	// Load from overwritten library paths
-	for (int i = 0; i < ArgPlatformCount; i++) {
-		if (args.libPath[i] != "") {
-			if (!isFile(args.libPath[i].c_str()))
-				std::cerr << "Could not open library for " << PlatformNames[i] << std::endl;
-			else if (!loadPlatform(platforms, PlatformNames[i], args.libPath[i].c_str(), args.verbose))
-				std::cerr << "Could not load library for " << PlatformNames[i] << std::endl;
+/**
+ * builds a single line record from the app headers and appinfo.json,
+ * the binaries are only inflated as far as the header reaches
+ */
+std::string metadataRecord(const PblAppArchive& appArchive, const std::string& inputFile, bool verbose) {
+	json11::Json::object platforms;
+	for (uint32_t i = 0; i < appArchive.getBinaryCount(); i++) {
+		PblAppHeader header;
+		if (!appArchive.extractBinaryHeader(i, &header, verbose))
+			continue;
+		if (memcmp(header.magic, "PBLAPP", 6) != 0) {
+			verbose && std::cerr << "Invalid header for pebble binary \"" << appArchive.getBinaryPlatform(i) << "\"" << std::endl;
+			continue;
 		}
+
+		platforms[appArchive.getBinaryPlatform(i)] = json11::Json::object {
+			{ "name", headerString(header.name, APP_NAME_SIZE) },
+			{ "company", headerString(header.company, APP_NAME_SIZE) },
+			{ "sdkVersion", headerVersion(header.sdk_version_major, header.sdk_version_minor) },
+			{ "appVersion", headerVersion(header.process_version_major, header.process_version_minor) },
+			{ "uuid", headerUUID(header.uuid) },
+			{ "flags", static_cast<int>(header.flags) }
+		};
 	}
 
-	// Load from SDK root
-	if (args.sdkroot != "") {
-		std::string sdkRoot = joinPath(args.sdkroot, nullptr);
-		if (!isDirectory(sdkRoot.c_str())) {
-			if (args.defaultSdkroot)
-				args.verbose && std::cerr << "Could not find any installed core sdk" << std::endl;
-			else
-				std::cerr << "Could not find specified core sdk" << std::endl;
+	json11::Json::object record {
+		{ "input", inputFile },
+		{ "platforms", platforms }
+	};
+	std::string appInfoText, parseError;
+	if (appArchive.extractAppInfo(appInfoText, verbose)) {
+		json11::Json appInfo = json11::Json::parse(appInfoText, parseError);
+		if (appInfo.is_object()) {
+			json11::Json::object appInfoObject = appInfo.object_items();
+			appInfoObject.erase("resources"); // the media list is large and not metadata
+			record["appinfo"] = appInfoObject;
 		}
-		else {
-			bool foundSomeLib = false;
-			std::string libDirPath = joinPath(sdkRoot, "pebble/");
-			for (int i = 0; i < ArgPlatformCount; i++) {
-				std::string libPath = joinPath(libDirPath, PlatformNames[i]);
-				libPath = joinPath(libPath, "lib/libpebble.a");
-				if (isFile(libPath.c_str())) {
-					foundSomeLib = true;
-
-					loadPlatform(platforms, PlatformNames[i], libPath.c_str(), args.verbose);
-				}
-			}
+		else
+			verbose && std::cerr << "Could not parse appinfo.json: " << parseError << std::endl;
+	}
+	return json11::Json(record).dump();
+}
 
-			if (!foundSomeLib && args.verbose)
-				std::cerr << "Could not load any libraries from core sdk" << std::endl;
-		}
+/**
+ * Scanning
+ */
+
+bool loadAppArchive(PblAppArchive& appArchive, const std::string& inputFile, std::vector<uint8_t>& inputBuffer, bool verbose) {
+	if (inputFile != "-")
+		return appArchive.load(inputFile.c_str(), verbose);
+
+	setBinaryStdin();
+	if (!readWholeStream(stdin, inputBuffer)) {
+		verbose && std::cerr << "Could not read pebble app archive from stdin" << std::endl;
+		return false;
 	}
+	return appArchive.loadFromMemory(inputBuffer.data(), inputBuffer.size(), verbose);
+}
 
-	if (platforms.size() == 0) {
-		std::cerr << "Could not load any library" << std::endl;
-		cleanPlatforms(platforms);
-		return 2;
+// returns false if not a single binary could be scanned or the input is over its budget
+// threads is the number of binaries extracted and scanned at the same time, 0 means one per core
+bool scanAppArchive(const PblAppArchive& appArchive, PlatformList& platforms, std::vector<PblAppBinary*>& binaries, ResultCache* cache, InputBudget& budget, uint32_t threads, bool verbose) {
+	uint32_t binaryCount = appArchive.getBinaryCount();
+	std::vector<PblLibrary*> libraries(binaryCount, nullptr);
+	for (uint32_t i = 0; i < binaryCount; i++) {
+		PlatformList::iterator itPlatform = findPlatform(platforms, appArchive.getBinaryPlatform(i));
+		if (itPlatform != platforms.end())
+			libraries[i] = &(*itPlatform)->library;
+		else
+			verbose && std::cerr << "Library for pebble binary \"" << appArchive.getBinaryPlatform(i) << "\" not loaded" << std::endl;
 	}
 
-	// Load pebble app and detect API functions
-	PblAppArchive appArchive;
-	std::vector<PblAppBinary*> binaries;
-	if (args.inputFile != "null") {
-		if (!appArchive.load(args.inputFile.c_str(), args.verbose)) {
-			cleanPlatforms(platforms);
-			return 3;
-		}
-		for (uint32_t i = 0; i < appArchive.getBinaryCount(); i++) {
-			PlatformList::iterator itPlatform = findPlatform(platforms, appArchive.getBinaryPlatform(i));
-			if (itPlatform == platforms.end()) {
-				args.verbose && std::cerr << "Library for pebble binary \"" << appArchive.getBinaryPlatform(i) << "\" not loaded" << std::endl;
+	// every scanner extracts, scans and releases one binary after the other, the archive can be read concurrently
+	// so at most one decompressed binary per scanner is alive, only the results are kept
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	threads = std::min(threads, binaryCount);
+	std::vector<PblAppBinary*> scanned(binaryCount, nullptr);
+	std::atomic<uint32_t> nextBinary(0);
+	auto scanBinaries = [&]() {
+		for (uint32_t i = nextBinary++; i < binaryCount; i = nextBinary++) {
+			PblLibrary* library = libraries[i];
+			if (library == nullptr)
 				continue;
-			}
-
-			// Load binary
-			uint32_t size;
-			void* buffer = appArchive.extractBinary(i, &size, args.verbose);
-			if (!buffer)
+			size_t size = 0;
+			uint8_t hash[Sha256::DigestSize];
+			void* buffer = appArchive.extractBinary(i, &size, verbose, cache != nullptr ? hash : nullptr, &budget);
+			if (buffer == nullptr)
 				continue;
-			PblAppBinary* binary = new PblAppBinary(buffer, size, &(*itPlatform)->library);
+			PblAppBinary* binary = new PblAppBinary(buffer, size, library);
 
-			args.verbose && std::cerr << "Scanning pebble binary \"" << appArchive.getBinaryPlatform(i) << "\"" << std::endl;
-			uint32_t foundAPIs = binary->scan();
-			args.verbose && std::cerr << "Found " << foundAPIs << " in pebble binary \"" << appArchive.getBinaryPlatform(i) << "\"" << std::endl;
+			verbose && std::cerr << "Scanning pebble binary \"" << appArchive.getBinaryPlatform(i) << "\"" << std::endl;
+			uint32_t foundAPIs = binary->scan(cache, hash, &budget);
+			verbose && std::cerr << "Found " << foundAPIs << " in pebble binary \"" << appArchive.getBinaryPlatform(i) << "\"" << std::endl;
 
-			binaries.push_back(binary);
+			binary->releaseBuffer();
+			scanned[i] = binary;
 		}
+	};
+	std::vector<std::thread> scanners;
+	for (uint32_t i = 1; i < threads; i++)
+		scanners.emplace_back(scanBinaries);
+	scanBinaries();
+	for (auto itScanner = scanners.begin(); itScanner != scanners.end(); ++itScanner)
+		itScanner->join();
 
-		if (binaries.size() == 0) {
-			std::cerr << "Could not scan any pebble binary" << std::endl;
-			cleanPlatforms(platforms);
-			return 4;
-		}
+	for (auto itBinary = scanned.begin(); itBinary != scanned.end(); ++itBinary) {
+		if (*itBinary != nullptr)
+			binaries.push_back(*itBinary);
 	}
 
-	// Output (as JSON)
-	std::ofstream outputFile;
-	if (args.outputFile != "") {
-		outputFile.open(args.outputFile.c_str(), std::ostream::out);
-		if (!outputFile) {
-			std::cerr << "Could not open output file" << std::endl;
-			return 5;
-		}
+	if (budget.isExceeded()) {
+		verbose && std::cerr << budget.getError() << std::endl;
+		for (auto itBinary = binaries.begin(); itBinary != binaries.end(); ++itBinary)
+			delete *itBinary;
+		binaries.clear();
+		return false;
 	}
-	std::ostream& output = (args.outputFile == "" ? std::cout : outputFile);
 
-	output << "{" << std::endl;
+	return binaries.size() > 0;
+}
+
+void cleanBinaries(std::vector<PblAppBinary*>& binaries) {
+	for (uint32_t i = 0; i < binaries.size(); i++)
+		delete binaries[i];
+	binaries.clear();
+}
+
+// binaries may be nullptr if no app was scanned
+void outputResult(JsonWriter& output, PlatformList& platforms, const std::vector<PblAppBinary*>* binaries, const ProgramArguments& args) {
+	output << "{" << '\n';
 	if (args.mapLibFunctions) {
 		outputIndent(output, 1 * INDENT_WIDTH);
 		output << "\"functions\": ";
-		outputFunctions(output, platforms, 1 * INDENT_WIDTH);
-		if (args.inputFile != "null")
+		FunctionMap functions;
+		libraryFunctions(platforms, functions);
+		outputFunctions(output, functions, 1 * INDENT_WIDTH);
+		if (binaries != nullptr)
 			output << ",";
-		output << std::endl;
+		output << '\n';
 	}
 
-	if (args.inputFile != "null") {
-		outputIndent(output, 1 * INDENT_WIDTH);
-		output << "\"platforms\": {" << std::endl;
-		for (uint32_t i = 0; i < binaries.size(); i++) {
-			if (i > 0)
-				output << "," << std::endl;
-			outputIndent(output, 2 * INDENT_WIDTH);
-			output << "\"" << binaries[i]->getPlatformName() << "\": ";
-			outputBinary(output, binaries[i], 2 * INDENT_WIDTH, args.outputSymbolOffsets);
-		}
-		output << std::endl;
+	if (binaries != nullptr) {
 		outputIndent(output, 1 * INDENT_WIDTH);
-		output << "}" << std::endl;
+		output << "\"platforms\": ";
+		outputPlatforms(output, *binaries, 1 * INDENT_WIDTH, args.outputSymbolOffsets);
+		output << '\n';
 	}
-	output << "}" << std::endl;
-	output.flush();
+	output << "}" << '\n';
+}
 
-	// Clean up and go home
-	for (uint32_t i = 0; i < binaries.size(); i++)
-		delete binaries[i];
-	binaries.clear();
-	cleanPlatforms(platforms);
+void outputError(JsonWriter& output, const char* message) {
+	output << "{" << '\n';
+	outputIndent(output, 1 * INDENT_WIDTH);
+	output << "\"error\": \"" << message << "\"" << '\n';
+	output << "}" << '\n';
+}
 
+/**
+ * scans every frame of a length prefixed stream on stdin and outputs one result per frame
+ * @returns the exit code
+ */
+int scanStdinStream(JsonWriter& output, PlatformList& platforms, ResultCache* cache, const ProgramArguments& args) {
+	std::vector<uint8_t> inputBuffer;
+	bool truncated = false, tooLarge = false;
+	uint32_t frameIndex = 0;
+	setBinaryStdin();
+	while (readStreamFrame(stdin, inputBuffer, MaxInlineInputSize, truncated, tooLarge)) {
+		PblAppArchive appArchive;
+		std::vector<PblAppBinary*> binaries;
+		InputBudget budget;
+		budget.start(args.budget);
+		if (tooLarge)
+			outputError(output, "Pebble app archive is too large");
+		else if (!appArchive.loadFromMemory(inputBuffer.data(), inputBuffer.size(), args.verbose))
+			outputError(output, "Could not open pebble app archive");
+		else if (!scanAppArchive(appArchive, platforms, binaries, cache, budget, args.jobs, args.verbose))
+			outputError(output, budget.isExceeded() ? budget.getError().c_str() : "Could not scan any pebble binary");
+		else
+			outputResult(output, platforms, &binaries, args);
+		output.flush();
+		cleanBinaries(binaries);
+		frameIndex++;
+	}
+
+	if (truncated) {
+		std::cerr << "Truncated stream after " << frameIndex << " pebble app archives" << std::endl;
+		return 3;
+	}
 	return 0;
 }
+
+/**
+ * outputs the start of a document with the results of many apps, functions may be nullptr
+ */
+void outputAppsBegin(JsonWriter& output, const FunctionMap* functions) {
+	output << "{" << '\n';
+	if (functions != nullptr) {
+		outputIndent(output, 1 * INDENT_WIDTH);
+		output << "\"functions\": ";
+		outputFunctions(output, *functions, 1 * INDENT_WIDTH);
+		output << "," << '\n';
+	}
+	outputIndent(output, 1 * INDENT_WIDTH);
+	output << "\"apps\": {";
+}
+
+void outputAppsBegin(JsonWriter& output, PlatformList& platforms, const ProgramArguments& args) {
+	FunctionMap functions;
+	if (args.mapLibFunctions)
+		libraryFunctions(platforms, functions);
+	outputAppsBegin(output, args.mapLibFunctions ? &functions : nullptr);
+}
+
+template<typename Binary>
+void outputApp(JsonWriter& output, const std::string& name, const std::vector<Binary*>& binaries, const std::vector<std::string>& errors, bool first, bool asSymbolOffset) {
+	output << (first ? "" : ",") << '\n';
+	outputIndent(output, 2 * INDENT_WIDTH);
+	output.writeString(name);
+	output << ": {" << '\n';
+	if (!binaries.empty()) {
+		outputIndent(output, 3 * INDENT_WIDTH);
+		output << "\"platforms\": ";
+		outputPlatforms(output, binaries, 3 * INDENT_WIDTH, asSymbolOffset);
+		output << (errors.empty() ? "" : ",") << '\n';
+	}
+	if (!errors.empty()) {
+		outputIndent(output, 3 * INDENT_WIDTH);
+		output << "\"errors\": [" << '\n';
+		for (uint32_t i = 0; i < errors.size(); i++) {
+			if (i > 0)
+				output << "," << '\n';
+			outputIndent(output, 4 * INDENT_WIDTH);
+			output.writeString(errors[i]);
+		}
+		output << '\n';
+		outputIndent(output, 3 * INDENT_WIDTH);
+		output << "]" << '\n';
+	}
+	outputIndent(output, 2 * INDENT_WIDTH);
+	output << "}";
+}
+
+void outputAppsEnd(JsonWriter& output) {
+	output << '\n';
+	outputIndent(output, 1 * INDENT_WIDTH);
+	output << "}" << '\n';
+	output << "}" << '\n';
+}
+
+/**
+ * scans every pbw inside a zip or tar bundle, the results are keyed by the path inside the bundle
+ * @returns the exit code
+ */
+int scanBundle(JsonWriter& output, PlatformList& platforms, ResultCache* cache, const ProgramArguments& args) {
+	PblBundle bundle;
+	if (!bundle.load(args.inputFile.c_str(), args.verbose))
+		return 3;
+	bundle.setMaxMemberSize(MaxInlineInputSize);
+
+	outputAppsBegin(output, platforms, args);
+
+	std::string name, memberError;
+	std::vector<uint8_t> inputBuffer;
+	uint32_t appCount = 0;
+	while (bundle.nextApp(name, inputBuffer, memberError, args.verbose)) {
+		args.verbose && std::cerr << "Scanning \"" << name << "\" from bundle" << std::endl;
+		PblAppArchive appArchive;
+		std::vector<PblAppBinary*> binaries;
+		std::vector<std::string> errors;
+		InputBudget budget;
+		budget.start(args.budget);
+		if (!memberError.empty())
+			errors.push_back(memberError);
+		else if (inputBuffer.empty() || !appArchive.loadFromMemory(inputBuffer.data(), inputBuffer.size(), args.verbose))
+			errors.push_back("Could not open pebble app archive");
+		else if (!scanAppArchive(appArchive, platforms, binaries, cache, budget, args.jobs, args.verbose))
+			errors.push_back(budget.isExceeded() ? budget.getError() : "Could not scan any pebble binary");
+		outputApp(output, name, binaries, errors, appCount++ == 0, args.outputSymbolOffsets);
+		cleanBinaries(binaries);
+	}
+
+	outputAppsEnd(output);
+	return bundle.hasFailed() ? 3 : 0;
+}
+
+/**
+ * runs the batch scan on the work-stealing pool, the staged pipeline or in worker processes
+ * the pipeline calls back in input order, the others as soon as an input is finished
+ */
+void runBatch(const std::vector<PblLibrary*>& libraries, const std::vector<std::string>& inputs, ResultCache* cache, const ProgramArguments& args, const BatchScanner::ResultCallback& callback) {
+	if (args.workers > 0) {
+		WorkerPool pool(libraries, args.workers, args.verbose);
+		pool.setResultCacheFile(cache != nullptr ? args.cacheFile : "");
+		pool.setBudget(args.budget);
+		pool.scan(inputs, callback);
+	}
+	else if (args.pipeline) {
+		BatchPipeline pipeline(libraries, args.pipelineConfig, args.verbose);
+		pipeline.setResultCache(cache);
+		pipeline.setBudget(args.budget);
+		pipeline.scan(inputs, callback);
+	}
+	else {
+		BatchScanner scanner(libraries, args.jobs, args.verbose);
+		scanner.setResultCache(cache);
+		scanner.setBudget(args.budget);
+		scanner.scan(inputs, callback);
+	}
+}
+
+// the part of the batch document that belongs to one input, without the separator in front of it
+std::string renderFragment(const std::string& input, const BatchScanner::AppResult& result, const ProgramArguments& args) {
+	JsonWriter fragment;
+	outputApp(fragment, input, result.binaries, result.errors, true, args.outputSymbolOffsets);
+	return fragment.str().substr(1); // without the line break that separates apps
+}
+
+void outputFragment(JsonWriter& output, const std::string& fragment, bool first) {
+	output << (first ? "" : ",") << '\n' << fragment;
+}
+
+/**
+ * Sharding
+ */
+
+static constexpr int PartialResultVersion = 2;
+
+// the shard only depends on the path, not on the order or the number of other inputs
+uint32_t shardOfInput(const std::string& input, uint32_t shardCount) {
+	Sha256 hasher;
+	hasher.update(input.data(), input.size());
+	uint8_t digest[Sha256::DigestSize];
+	hasher.finish(digest);
+	uint64_t value = 0;
+	for (int i = 0; i < 8; i++)
+		value = (value << 8) | digest[i];
+	return static_cast<uint32_t>(value % shardCount);
+}
+
+// identifies the complete input list, shards of the same run have the same one
+std::string inputListHash(const std::vector<std::string>& inputs) {
+	Sha256 hasher;
+	for (auto itInput = inputs.begin(); itInput != inputs.end(); ++itInput)
+		hasher.update(itInput->c_str(), itInput->size() + 1); // with the terminator, so paths cannot run into each other
+	uint8_t digest[Sha256::DigestSize];
+	hasher.finish(digest);
+	return hexString(digest, sizeof(digest));
+}
+
+// globalIndices receives the position of every selected input in the complete input list
+std::vector<std::string> shardInputs(const std::vector<std::string>& inputs, const ProgramArguments& args, std::vector<uint32_t>* globalIndices) {
+	std::vector<std::string> selected;
+	for (uint32_t i = 0; i < inputs.size(); i++) {
+		if (shardOfInput(inputs[i], args.shardCount) != args.shardIndex)
+			continue;
+		selected.push_back(inputs[i]);
+		if (globalIndices != nullptr)
+			globalIndices->push_back(i);
+	}
+	return selected;
+}
+
+/**
+ * scans the inputs of one shard and writes a partial result: a header line describing the shard
+ * and the whole run, then one line per input with its position and its part of the final document
+ * @returns the exit code
+ */
+int scanShard(PlatformList& platforms, const std::vector<PblLibrary*>& libraries, const std::vector<std::string>& allInputs, ResultCache* cache, const ProgramArguments& args) {
+	std::vector<uint32_t> globalIndices;
+	std::vector<std::string> inputs = shardInputs(allInputs, args, &globalIndices);
+
+	JsonWriter output;
+	if (!openOutput(output, args))
+		return 5;
+	JsonWriter documentBegin;
+	outputAppsBegin(documentBegin, platforms, args);
+	output << json11::Json(json11::Json::object {
+		{ "partial", PartialResultVersion },
+		{ "shard", static_cast<int>(args.shardIndex) },
+		{ "shards", static_cast<int>(args.shardCount) },
+		{ "inputs", static_cast<int>(allInputs.size()) },
+		{ "inputList", inputListHash(allInputs) },
+		{ "selected", static_cast<int>(inputs.size()) },
+		{ "begin", documentBegin.str() }
+	}).dump() << '\n';
+
+	std::mutex outputMutex;
+	runBatch(libraries, inputs, cache, args, [&](uint32_t inputIndex, BatchScanner::AppResult& result) {
+		std::string record = json11::Json(json11::Json::object {
+			{ "index", static_cast<int>(globalIndices[inputIndex]) },
+			{ "input", inputs[inputIndex] },
+			{ "fragment", renderFragment(inputs[inputIndex], result, args) }
+		}).dump();
+		std::lock_guard<std::mutex> lock(outputMutex);
+		output << record << '\n';
+	});
+	output.flush();
+	return output.good() ? 0 : 5;
+}
+
+/**
+ * combines the partial results of all shards into the document a single run would have written
+ * @returns the exit code
+ */
+int mergePartials(const ProgramArguments& args) {
+	json11::Json firstHeader;
+	std::vector<bool> shardSeen;
+	std::vector<std::string> fragments;
+	std::vector<bool> fragmentSeen;
+	for (auto itPartial = args.inputFiles.begin(); itPartial != args.inputFiles.end(); ++itPartial) {
+		std::ifstream partial(itPartial->c_str());
+		std::string line, error;
+		if (!partial || !std::getline(partial, line)) {
+			std::cerr << "Could not read partial result \"" << *itPartial << "\"" << std::endl;
+			return 3;
+		}
+
+		json11::Json header = json11::Json::parse(line, error);
+		if (header["partial"].int_value() != PartialResultVersion) {
+			std::cerr << "\"" << *itPartial << "\" is not a partial result" << std::endl;
+			return 3;
+		}
+		if (firstHeader.is_null()) {
+			firstHeader = header;
+			shardSeen.resize(header["shards"].int_value(), false);
+			fragments.resize(header["inputs"].int_value());
+			fragmentSeen.resize(fragments.size(), false);
+		}
+		else if (header["shards"] != firstHeader["shards"] || header["inputs"] != firstHeader["inputs"] || header["inputList"] != firstHeader["inputList"] || header["begin"] != firstHeader["begin"]) {
+			std::cerr << "\"" << *itPartial << "\" belongs to a different run" << std::endl;
+			return 3;
+		}
+		int shard = header["shard"].int_value();
+		if (shard < 0 || static_cast<size_t>(shard) >= shardSeen.size() || shardSeen[shard]) {
+			std::cerr << "\"" << *itPartial << "\" has an invalid or duplicate shard" << std::endl;
+			return 3;
+		}
+		shardSeen[shard] = true;
+
+		int records = 0;
+		while (std::getline(partial, line)) {
+			json11::Json record = json11::Json::parse(line, error);
+			int index = record["index"].int_value();
+			if (!record["fragment"].is_string() || index < 0 || static_cast<size_t>(index) >= fragments.size() || fragmentSeen[index]) {
+				std::cerr << "Invalid record in partial result \"" << *itPartial << "\"" << std::endl;
+				return 3;
+			}
+			fragments[index] = record["fragment"].string_value();
+			fragmentSeen[index] = true;
+			records++;
+		}
+		if (records != header["selected"].int_value()) {
+			std::cerr << "Partial result \"" << *itPartial << "\" is incomplete" << std::endl;
+			return 3;
+		}
+	}
+
+	uint32_t missingShards = static_cast<uint32_t>(std::count(shardSeen.begin(), shardSeen.end(), false));
+	if (missingShards > 0) {
+		std::cerr << "Missing the partial results of " << missingShards << " shards" << std::endl;
+		return 3;
+	}
+
+	JsonWriter output;
+	if (!openOutput(output, args))
+		return 5;
+	output << firstHeader["begin"].string_value();
+	for (uint32_t i = 0; i < fragments.size(); i++)
+		outputFragment(output, fragments[i], i == 0);
+	outputAppsEnd(output);
+	return output.flush() ? 0 : 5;
+}
+
+/**
+ * scans the batch inputs that the journal does not know yet and records their results in it
+ * in document mode the results are kept next to the journal and the document is written at the end
+ * @returns the exit code
+ */
+int scanJournaled(PlatformList& platforms, const std::vector<PblLibrary*>& libraries, const std::vector<std::string>& inputs, ResultCache* cache, const ProgramArguments& args) {
+	BatchJournal journal(args.verbose);
+	std::string dataFile = args.ndjson ? args.outputFile : args.journalFile + ".data";
+	uint32_t flags = (args.ndjson ? BatchJournal::Flag_Ndjson : 0) | (args.outputSymbolOffsets ? BatchJournal::Flag_SymbolOffsets : 0);
+	if (!journal.open(args.journalFile, dataFile, flags, args.resume)) {
+		std::cerr << "Could not open journal" << std::endl;
+		return 5;
+	}
+
+	std::vector<std::string> remaining;
+	for (auto itInput = inputs.begin(); itInput != inputs.end(); ++itInput) {
+		if (!journal.isFinished(*itInput))
+			remaining.push_back(*itInput);
+	}
+
+	std::atomic<bool> writeFailed(false);
+	runBatch(libraries, remaining, cache, args, [&](uint32_t inputIndex, BatchScanner::AppResult& result) {
+		static thread_local std::string record;
+		if (args.ndjson)
+			NdjsonWriter::serialize(record, remaining[inputIndex], result, args.outputSymbolOffsets);
+		else
+			record = renderFragment(remaining[inputIndex], result, args);
+		if (!journal.append(remaining[inputIndex], record))
+			writeFailed = true;
+	});
+	if (!journal.sync() || writeFailed) {
+		std::cerr << "Could not write journal" << std::endl;
+		return 5;
+	}
+	if (args.ndjson)
+		return 0;
+
+	JsonWriter output;
+	if (!openOutput(output, args))
+		return 5;
+	outputAppsBegin(output, platforms, args);
+	std::string fragment;
+	for (uint32_t i = 0; i < inputs.size(); i++) {
+		if (!journal.readResult(inputs[i], fragment)) {
+			std::cerr << "Could not read the result of \"" << inputs[i] << "\" from the journal" << std::endl;
+			return 5;
+		}
+		outputFragment(output, fragment, i == 0);
+	}
+	outputAppsEnd(output);
+	return output.flush() ? 0 : 5;
+}
+
+/**
+ * Aggregation
+ */
+
+std::string sdkVersionString(uint16_t version) {
+	return headerVersion(version >> 8, version & 0xff);
+}
+
+bool parseSdkVersion(const std::string& str, uint16_t& version) {
+	char* end;
+	unsigned long major = strtoul(str.c_str(), &end, 10);
+	if (*end != '.')
+		return false;
+	unsigned long minor = strtoul(end + 1, &end, 10);
+	version = static_cast<uint16_t>(((major & 0xff) << 8) | (minor & 0xff));
+	return *end == '\0';
+}
+
+// which part of which run a report counts, only reports of the shards of one run can be added up
+struct ReportRun {
+	std::string libraries; // a hash of the signatures of all libraries
+	uint32_t shard = 0;
+	uint32_t shards = 1;
+	uint32_t inputs = 0; // of all shards
+	std::string inputList; // a hash of the inputs of all shards
+};
+
+std::string librariesSignature(const std::vector<PblLibrary*>& libraries) {
+	Sha256 hasher;
+	for (auto itLibrary = libraries.begin(); itLibrary != libraries.end(); ++itLibrary)
+		hasher.update((*itLibrary)->getSignature(), Sha256::DigestSize);
+	uint8_t digest[Sha256::DigestSize];
+	hasher.finish(digest);
+	return hexString(digest, sizeof(digest));
+}
+
+/**
+ * outputs the usage of every function per platform, the counts stay exact, so reports can be added up
+ */
+void outputReport(JsonWriter& output, const UsageAggregator& aggregator, const ReportRun& run) {
+	output << "{" << '\n';
+	outputIndent(output, 1 * INDENT_WIDTH);
+	output << "\"aggregate\": {" << '\n';
+	outputIndent(output, 2 * INDENT_WIDTH);
+	output << "\"libraries\": ";
+	output.writeString(run.libraries);
+	output << "," << '\n';
+	outputIndent(output, 2 * INDENT_WIDTH);
+	output << "\"shard\": " << run.shard << "," << '\n';
+	outputIndent(output, 2 * INDENT_WIDTH);
+	output << "\"shards\": " << run.shards << "," << '\n';
+	outputIndent(output, 2 * INDENT_WIDTH);
+	output << "\"inputs\": " << run.inputs << "," << '\n';
+	outputIndent(output, 2 * INDENT_WIDTH);
+	output << "\"inputList\": ";
+	output.writeString(run.inputList);
+	output << "," << '\n';
+	outputIndent(output, 2 * INDENT_WIDTH);
+	output << "\"apps\": " << aggregator.getAppCount() << "," << '\n';
+	outputIndent(output, 2 * INDENT_WIDTH);
+	output << "\"failedApps\": " << aggregator.getFailedAppCount() << "," << '\n';
+	outputIndent(output, 2 * INDENT_WIDTH);
+	output << "\"platforms\": [";
+
+	const std::vector<UsageAggregator::PlatformTotals>& platforms = aggregator.getPlatforms();
+	for (auto itPlatform = platforms.begin(); itPlatform != platforms.end(); ++itPlatform) {
+		output << (itPlatform == platforms.begin() ? "" : ",") << '\n';
+		outputIndent(output, 3 * INDENT_WIDTH);
+		output << "{" << '\n';
+		outputIndent(output, 4 * INDENT_WIDTH);
+		output << "\"name\": ";
+		output.writeString(itPlatform->name);
+		output << "," << '\n';
+		outputIndent(output, 4 * INDENT_WIDTH);
+		output << "\"binaries\": " << itPlatform->binaries << "," << '\n';
+
+		outputIndent(output, 4 * INDENT_WIDTH);
+		output << "\"sdkVersions\": {";
+		for (auto itVersion = itPlatform->sdkVersions.begin(); itVersion != itPlatform->sdkVersions.end(); ++itVersion) {
+			output << (itVersion == itPlatform->sdkVersions.begin() ? "" : ",") << '\n';
+			outputIndent(output, 5 * INDENT_WIDTH);
+			output.writeString(sdkVersionString(itVersion->first));
+			output << ": " << itVersion->second;
+		}
+		output << '\n';
+		outputIndent(output, 4 * INDENT_WIDTH);
+		output << "}," << '\n';
+
+		// one line per function, ordered by symbol table offset
+		outputIndent(output, 4 * INDENT_WIDTH);
+		output << "\"functions\": [";
+		bool first = true;
+		for (uint32_t i = 0; i < itPlatform->functions.size(); i++) {
+			const UsageAggregator::FunctionTotals& function = itPlatform->functions[i];
+			if (function.name.empty())
+				continue;
+			output << (first ? "" : ",") << '\n';
+			first = false;
+			char percent[16];
+			snprintf(percent, sizeof(percent), "%.2f", itPlatform->binaries > 0 ? function.apps * 100.0 / itPlatform->binaries : 0.0);
+			outputIndent(output, 5 * INDENT_WIDTH);
+			output << "{ \"name\": ";
+			output.writeString(function.name);
+			output << ", \"symbolOffset\": " << i << ", \"apps\": " << function.apps << ", \"percent\": " << percent;
+			if (function.apps > 0) {
+				output << ", \"firstSdk\": ";
+				output.writeString(sdkVersionString(function.firstSdk));
+				output << ", \"lastSdk\": ";
+				output.writeString(sdkVersionString(function.lastSdk));
+			}
+			output << " }";
+		}
+		output << '\n';
+		outputIndent(output, 4 * INDENT_WIDTH);
+		output << "]" << '\n';
+		outputIndent(output, 3 * INDENT_WIDTH);
+		output << "}";
+	}
+	output << '\n';
+	outputIndent(output, 2 * INDENT_WIDTH);
+	output << "]" << '\n';
+	outputIndent(output, 1 * INDENT_WIDTH);
+	output << "}" << '\n';
+	output << "}" << '\n';
+}
+
+/**
+ * adds up the reports of several runs, e.g. of the shards of one run
+ * @returns the exit code
+ */
+int mergeReports(const ProgramArguments& args) {
+	UsageAggregator aggregator((std::vector<PblLibrary*>()));
+	json11::Json firstReport;
+	std::vector<bool> shardSeen;
+	for (auto itReport = args.inputFiles.begin(); itReport != args.inputFiles.end(); ++itReport) {
+		std::vector<uint8_t> content;
+		FILE* file = fopen(itReport->c_str(), "rb");
+		bool read = file != nullptr && readWholeStream(file, content);
+		if (file != nullptr)
+			fclose(file);
+		if (!read) {
+			std::cerr << "Could not read report \"" << *itReport << "\"" << std::endl;
+			return 3;
+		}
+
+		std::string error;
+		json11::Json report = json11::Json::parse(std::string(content.begin(), content.end()), error);
+		const json11::Json& aggregate = report["aggregate"];
+		if (!aggregate.is_object() || !aggregate["platforms"].is_array()) {
+			std::cerr << "\"" << *itReport << "\" is not an aggregate report" << std::endl;
+			return 3;
+		}
+		// counts of different libraries or inputs cannot be added up
+		if (firstReport.is_null()) {
+			firstReport = aggregate;
+			shardSeen.resize(std::max(0, aggregate["shards"].int_value()), false);
+		}
+		else if (aggregate["libraries"] != firstReport["libraries"] || aggregate["shards"] != firstReport["shards"] || aggregate["inputs"] != firstReport["inputs"] || aggregate["inputList"] != firstReport["inputList"]) {
+			std::cerr << "\"" << *itReport << "\" belongs to a different run" << std::endl;
+			return 3;
+		}
+		int shard = aggregate["shard"].int_value();
+		if (!aggregate["libraries"].is_string() || !aggregate["shard"].is_number() || shard < 0 || static_cast<size_t>(shard) >= shardSeen.size() || shardSeen[shard]) {
+			std::cerr << "\"" << *itReport << "\" has an invalid or duplicate shard" << std::endl;
+			return 3;
+		}
+		shardSeen[shard] = true;
+
+		std::vector<UsageAggregator::PlatformTotals> platforms;
+		for (auto itPlatform = aggregate["platforms"].array_items().begin(); itPlatform != aggregate["platforms"].array_items().end(); ++itPlatform) {
+			UsageAggregator::PlatformTotals platform;
+			platform.name = (*itPlatform)["name"].string_value();
+			platform.binaries = static_cast<uint32_t>((*itPlatform)["binaries"].int_value());
+			const json11::Json::object& versions = (*itPlatform)["sdkVersions"].object_items();
+			for (auto itVersion = versions.begin(); itVersion != versions.end(); ++itVersion) {
+				uint16_t version;
+				if (parseSdkVersion(itVersion->first, version))
+					platform.sdkVersions[version] += static_cast<uint32_t>(itVersion->second.int_value());
+			}
+			const json11::Json::array& functions = (*itPlatform)["functions"].array_items();
+			for (auto itFunction = functions.begin(); itFunction != functions.end(); ++itFunction) {
+				int symbolTableOffset = (*itFunction)["symbolOffset"].int_value();
+				if (symbolTableOffset < 0)
+					continue;
+				if (static_cast<size_t>(symbolTableOffset) >= platform.functions.size())
+					platform.functions.resize(symbolTableOffset + 1);
+				UsageAggregator::FunctionTotals& function = platform.functions[symbolTableOffset];
+				function.name = (*itFunction)["name"].string_value();
+				function.apps = static_cast<uint32_t>((*itFunction)["apps"].int_value());
+				parseSdkVersion((*itFunction)["firstSdk"].string_value(), function.firstSdk);
+				parseSdkVersion((*itFunction)["lastSdk"].string_value(), function.lastSdk);
+			}
+			platforms.push_back(platform);
+		}
+		aggregator.addTotals(static_cast<uint32_t>(aggregate["apps"].int_value()), static_cast<uint32_t>(aggregate["failedApps"].int_value()), platforms);
+	}
+
+	uint32_t missingShards = static_cast<uint32_t>(std::count(shardSeen.begin(), shardSeen.end(), false));
+	if (missingShards > 0) {
+		std::cerr << "Missing the reports of " << missingShards << " shards" << std::endl;
+		return 3;
+	}
+
+	ReportRun run;
+	run.libraries = firstReport["libraries"].string_value();
+	run.inputs = static_cast<uint32_t>(firstReport["inputs"].int_value());
+	run.inputList = firstReport["inputList"].string_value();
+	JsonWriter output;
+	if (!openOutput(output, args))
+		return 5;
+	outputReport(output, aggregator, run);
+	return output.flush() ? 0 : 5;
+}
+
+// the input files and the pbws of the input directories and the input list
+bool collectBatchInputs(const ProgramArguments& args, std::vector<std::string>& inputs) {
+	DirectoryWalker walker(args.jobs, args.verbose);
+	walker.setFilters(args.includes, args.excludes);
+	for (auto itInput = args.inputFiles.begin(); itInput != args.inputFiles.end(); ++itInput) {
+		if (!isDirectory(itInput->c_str()))
+			inputs.push_back(*itInput);
+		else if (!walker.walk(*itInput, inputs)) {
+			std::cerr << "Could not read directory \"" << *itInput << "\"" << std::endl;
+			return false;
+		}
+	}
+	if (args.inputList != "" && !readInputList(args.inputList, inputs)) {
+		std::cerr << "Could not read input list" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * scans all batch inputs on a thread pool, the libraries are shared between all threads
+ * @returns the exit code
+ */
+int scanBatch(PlatformList& platforms, ResultCache* cache, const ProgramArguments& args) {
+	std::vector<std::string> inputs;
+	if (!collectBatchInputs(args, inputs))
+		return 3;
+
+	std::vector<PblLibrary*> libraries;
+	for (auto itPlatform = platforms.begin(); itPlatform != platforms.end(); ++itPlatform) {
+		if (!(*itPlatform)->mappingOnly)
+			libraries.push_back(&(*itPlatform)->library);
+	}
+
+	if (args.shardCount > 0 && !args.ndjson && !args.compact && !args.aggregate)
+		return scanShard(platforms, libraries, inputs, cache, args);
+	uint32_t allInputCount = static_cast<uint32_t>(inputs.size());
+	std::string allInputList = args.aggregate ? inputListHash(inputs) : "";
+	if (args.shardCount > 0) // json lines of all shards can simply be concatenated, compact records appended and reports merged
+		inputs = shardInputs(inputs, args, nullptr);
+	if (args.journalFile != "")
+		return scanJournaled(platforms, libraries, inputs, cache, args);
+
+	// every record is written as soon as its input is finished
+	if (args.ndjson) {
+		NdjsonWriter writer;
+		if (!writer.open(args.outputFile, args.outputCompression, args.jobs)) {
+			std::cerr << "Could not open output file" << std::endl;
+			return 5;
+		}
+		std::atomic<bool> writeFailed(false);
+		runBatch(libraries, inputs, cache, args, [&](uint32_t inputIndex, BatchScanner::AppResult& result) {
+			static thread_local std::string record;
+			NdjsonWriter::serialize(record, inputs[inputIndex], result, args.outputSymbolOffsets);
+			if (!writer.write(record))
+				writeFailed = true;
+		});
+		if (!writer.flush())
+			writeFailed = true;
+		if (writeFailed) {
+			std::cerr << "Could not write to output file" << std::endl;
+			return 5;
+		}
+		return 0;
+	}
+
+	// only the counters are kept, the result of every input is dropped right away
+	if (args.aggregate) {
+		UsageAggregator aggregator(libraries);
+		runBatch(libraries, inputs, cache, args, [&](uint32_t, BatchScanner::AppResult& result) {
+			aggregator.add(result);
+		});
+		aggregator.finish();
+		ReportRun run;
+		run.libraries = librariesSignature(libraries);
+		if (args.shardCount > 0) {
+			run.shard = args.shardIndex;
+			run.shards = args.shardCount;
+		}
+		run.inputs = allInputCount;
+		run.inputList = allInputList;
+		JsonWriter output;
+		if (!openOutput(output, args))
+			return 5;
+		outputReport(output, aggregator, run);
+		return output.flush() ? 0 : 5;
+	}
+
+	// like json lines, every record is appended as soon as its input is finished
+	if (args.compact) {
+		CompactResultFile compactFile;
+		if (!compactFile.create(args.outputFile, libraries, args.verbose)) {
+			std::cerr << "Could not open compact result file" << std::endl;
+			return 5;
+		}
+		std::atomic<bool> writeFailed(false);
+		runBatch(libraries, inputs, cache, args, [&](uint32_t inputIndex, BatchScanner::AppResult& result) {
+			if (!compactFile.append(inputs[inputIndex], result))
+				writeFailed = true;
+		});
+		if (writeFailed) {
+			std::cerr << "Could not write to compact result file" << std::endl;
+			return 5;
+		}
+		return 0;
+	}
+
+	// results already arrive in order, nothing has to be kept after it is written
+	if (args.pipeline) {
+		JsonWriter output;
+		if (!openOutput(output, args))
+			return 5;
+		outputAppsBegin(output, platforms, args);
+		runBatch(libraries, inputs, cache, args, [&](uint32_t inputIndex, BatchScanner::AppResult& result) {
+			outputApp(output, inputs[inputIndex], result.binaries, result.errors, inputIndex == 0, args.outputSymbolOffsets);
+		});
+		outputAppsEnd(output);
+		return output.flush() ? 0 : 5;
+	}
+
+	std::vector<BatchScanner::AppResult> results(inputs.size());
+	runBatch(libraries, inputs, cache, args, [&](uint32_t inputIndex, BatchScanner::AppResult& result) {
+		results[inputIndex].binaries.swap(result.binaries);
+		results[inputIndex].errors.swap(result.errors);
+	});
+
+	JsonWriter output;
+	if (!openOutput(output, args))
+		return 5;
+	outputAppsBegin(output, platforms, args);
+	for (uint32_t i = 0; i < inputs.size(); i++)
+		outputApp(output, inputs[i], results[i].binaries, results[i].errors, i == 0, args.outputSymbolOffsets);
+	outputAppsEnd(output);
+	return output.flush() ? 0 : 5;
+}
+
+/**
+ * converts a compact result file into the document a batch writes, the names of the functions
+ * come from the file, so no library is needed
+ * @returns the exit code
+ */
+int decodeCompact(const ProgramArguments& args) {
+	CompactResultFile compactFile;
+	if (!compactFile.load(args.inputFiles[0], args.verbose)) {
+		std::cerr << "Could not read compact result file" << std::endl;
+		return 3;
+	}
+
+	FunctionMap functions;
+	for (uint32_t i = 0; args.mapLibFunctions && i < compactFile.getPlatformCount(); i++) {
+		const std::vector<std::string>& names = compactFile.getPlatform(i).functionNames;
+		for (uint32_t j = 0; j < names.size(); j++) {
+			if (!names[j].empty())
+				functions.add(j, names[j]);
+		}
+	}
+	functions.finish();
+
+	JsonWriter output;
+	if (!openOutput(output, args))
+		return 5;
+	outputAppsBegin(output, args.mapLibFunctions ? &functions : nullptr);
+	CompactResultFile::Record record;
+	std::vector<const CompactResultFile::Binary*> binaries;
+	for (uint32_t i = 0; i < compactFile.getRecordCount(); i++) {
+		compactFile.getRecord(i, record);
+		binaries.clear();
+		for (auto itBinary = record.binaries.begin(); itBinary != record.binaries.end(); ++itBinary)
+			binaries.push_back(&*itBinary);
+		outputApp(output, record.input, binaries, record.errors, i == 0, args.outputSymbolOffsets);
+	}
+	outputAppsEnd(output);
+	return output.flush() ? 0 : 5;
+}
+
+#ifndef WIN32
+/**
+ * Daemon mode
+ */
+
+static constexpr size_t MaxRequestLineSize = 4096;
+static constexpr time_t RequestTimeoutSeconds = 30; // an idle client does not hold a worker longer
+static constexpr long MaxAcceptDelayMilliseconds = 1000; // failing accepts, e.g. out of file descriptors, are retried up to this slowly
+
+static volatile sig_atomic_t reloadRequested = 0;
+static volatile sig_atomic_t stopRequested = 0;
+
+void onReloadSignal(int) {
+	reloadRequested = 1;
+}
+
+void onStopSignal(int) {
+	stopRequested = 1;
+}
+
+/**
+ * a set of loaded libraries, requests keep their set alive while a reload installs a new one
+ */
+struct ResidentPlatforms {
+	StringPool functionNames;
+	PlatformList platforms;
+
+	~ResidentPlatforms() {
+		cleanPlatforms(platforms);
+	}
+};
+
+struct ServerState {
+	const ProgramArguments& args;
+	ResultCache* cache;
+	std::mutex platformsMutex;
+	std::shared_ptr<ResidentPlatforms> platforms;
+	std::mutex reloadMutex;
+
+	ServerState(const ProgramArguments& arguments, ResultCache* resultCache) : args(arguments), cache(resultCache) {
+	}
+
+	std::shared_ptr<ResidentPlatforms> currentPlatforms() {
+		std::lock_guard<std::mutex> lock(platformsMutex);
+		return platforms;
+	}
+
+	// the old libraries are released by the last request that still uses them
+	bool reload() {
+		std::lock_guard<std::mutex> reloadLock(reloadMutex);
+		std::shared_ptr<ResidentPlatforms> reloaded = std::make_shared<ResidentPlatforms>();
+		if (!loadPlatforms(reloaded->platforms, reloaded->functionNames, args)) {
+			std::cerr << "Could not load any library, keeping the previous libraries" << std::endl;
+			return false;
+		}
+		std::lock_guard<std::mutex> lock(platformsMutex);
+		platforms.swap(reloaded);
+		args.verbose && std::cerr << "Reloaded " << platforms->platforms.size() << " libraries" << std::endl;
+		return true;
+	}
+};
+
+bool sendAll(int fd, const std::string& data) {
+	size_t total = 0;
+	while (total < data.size()) {
+		ssize_t sent = send(fd, data.data() + total, data.size() - total, MSG_NOSIGNAL);
+		if (sent < 0 && errno == EINTR)
+			continue;
+		if (sent <= 0)
+			return false;
+		total += sent;
+	}
+	return true;
+}
+
+// reads the request line, bytes after it are kept in rest
+bool receiveLine(int fd, std::string& line, std::vector<uint8_t>& rest) {
+	char buffer[MaxRequestLineSize];
+	std::string received;
+	while (received.size() < MaxRequestLineSize) {
+		ssize_t size = recv(fd, buffer, sizeof(buffer), 0);
+		if (size < 0 && errno == EINTR)
+			continue;
+		if (size <= 0)
+			break;
+		received.append(buffer, size);
+		size_t lineEnd = received.find('\n');
+		if (lineEnd != std::string::npos) {
+			line = received.substr(0, lineEnd);
+			rest.assign(received.begin() + lineEnd + 1, received.end());
+			return true;
+		}
+	}
+	return false;
+}
+
+bool receiveAll(int fd, std::vector<uint8_t>& buffer, size_t offset) {
+	while (offset < buffer.size()) {
+		ssize_t size = recv(fd, buffer.data() + offset, buffer.size() - offset, 0);
+		if (size < 0 && errno == EINTR)
+			continue;
+		if (size <= 0)
+			return false;
+		offset += size;
+	}
+	return true;
+}
+
+/**
+ * answers a single request, one of:
+ *   scan <path>\n
+ *   data <size>\n<size bytes of a pbw>
+ *   reload\n
+ */
+void serveRequest(int fd, ServerState& state) {
+	const ProgramArguments& args = state.args;
+	JsonWriter output;
+	std::string line;
+	std::vector<uint8_t> inputBuffer;
+	if (!receiveLine(fd, line, inputBuffer))
+		outputError(output, "Could not read request");
+	else if (line == "reload") {
+		if (state.reload())
+			output << "{" << '\n' << "  \"reloaded\": true" << '\n' << "}" << '\n';
+		else
+			outputError(output, "Could not load any library");
+	}
+	else if (line.compare(0, 5, "scan ") == 0 || line.compare(0, 5, "data ") == 0) {
+		std::shared_ptr<ResidentPlatforms> resident = state.currentPlatforms();
+		PblAppArchive appArchive;
+		std::vector<PblAppBinary*> binaries;
+		bool loaded;
+		if (line[0] == 's')
+			loaded = appArchive.load(line.c_str() + 5, args.verbose);
+		else {
+			char* end;
+			unsigned long long size = strtoull(line.c_str() + 5, &end, 10);
+			size_t received = inputBuffer.size();
+			if (*end == '\0' && size > MaxInlineInputSize) {
+				outputError(output, "Request data is too large");
+				sendAll(fd, output.str());
+				return;
+			}
+			loaded = *end == '\0' && line.size() > 5 && size >= received;
+			if (loaded) {
+				inputBuffer.resize(static_cast<size_t>(size));
+				loaded = receiveAll(fd, inputBuffer, received) &&
+					appArchive.loadFromMemory(inputBuffer.data(), inputBuffer.size(), args.verbose);
+			}
+		}
+
+		InputBudget budget;
+		budget.start(args.budget);
+		if (!loaded)
+			outputError(output, "Could not open pebble app archive");
+		// requests already run on -j threads, each one scans its binaries one after the other
+		else if (!scanAppArchive(appArchive, resident->platforms, binaries, state.cache, budget, 1, args.verbose))
+			outputError(output, budget.isExceeded() ? budget.getError().c_str() : "Could not scan any pebble binary");
+		else
+			outputResult(output, resident->platforms, &binaries, args);
+		cleanBinaries(binaries);
+	}
+	else
+		outputError(output, "Unknown request");
+
+	sendAll(fd, output.str());
+}
+
+/**
+ * keeps the libraries loaded and answers requests on a unix socket until SIGINT or SIGTERM
+ * SIGHUP or a "reload" request reloads the libraries without interrupting running requests
+ * @returns the exit code
+ */
+int serveSocket(PlatformList& platforms, ResultCache* cache, const ProgramArguments& args) {
+	ServerState state(args, cache);
+	state.platforms = std::make_shared<ResidentPlatforms>();
+	state.platforms->platforms.swap(platforms);
+
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (args.serveSocket.size() >= sizeof(address.sun_path)) {
+		std::cerr << "Socket path is too long" << std::endl;
+		return 5;
+	}
+	strcpy(address.sun_path, args.serveSocket.c_str());
+
+	// a socket left behind by a previous server is replaced, any other file is not
+	struct stat socketStat;
+	if (lstat(args.serveSocket.c_str(), &socketStat) == 0 && S_ISSOCK(socketStat.st_mode))
+		unlink(args.serveSocket.c_str());
+
+	// non-blocking, a connection that is gone before it is accepted does not block the loop
+	int listenSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (listenSocket < 0 || bind(listenSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+		listen(listenSocket, SOMAXCONN) != 0) {
+		std::cerr << "Could not listen on socket: " << strerror(errno) << std::endl;
+		if (listenSocket >= 0)
+			close(listenSocket);
+		return 5;
+	}
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = onReloadSignal;
+	sigaction(SIGHUP, &action, nullptr);
+	action.sa_handler = onStopSignal;
+	sigaction(SIGINT, &action, nullptr);
+	sigaction(SIGTERM, &action, nullptr);
+
+	// the signals are only delivered while ppoll waits, so none can slip in between checking the flags and waiting
+	// the request threads inherit the blocked signals, they always go to the accepting thread
+	sigset_t blockedSignals, waitSignals;
+	sigemptyset(&blockedSignals);
+	sigaddset(&blockedSignals, SIGHUP);
+	sigaddset(&blockedSignals, SIGINT);
+	sigaddset(&blockedSignals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &blockedSignals, &waitSignals);
+	sigdelset(&waitSignals, SIGHUP);
+	sigdelset(&waitSignals, SIGINT);
+	sigdelset(&waitSignals, SIGTERM);
+
+	args.verbose && std::cerr << "Serving on " << args.serveSocket << std::endl;
+	{
+		ThreadPool pool(args.jobs);
+		long acceptDelay = 0;
+		while (!stopRequested) {
+			if (reloadRequested) {
+				reloadRequested = 0;
+				state.reload();
+			}
+			pollfd listenPoll;
+			listenPoll.fd = listenSocket;
+			listenPoll.events = POLLIN;
+			listenPoll.revents = 0;
+			int ready;
+			if (acceptDelay > 0) { // after a failed accept the listen socket is ready right away, only the delay is waited
+				timespec delay;
+				delay.tv_sec = acceptDelay / 1000;
+				delay.tv_nsec = (acceptDelay % 1000) * 1000000;
+				ready = ppoll(nullptr, 0, &delay, &waitSignals);
+			}
+			else
+				ready = ppoll(&listenPoll, 1, nullptr, &waitSignals);
+			if (ready < 0 || (acceptDelay == 0 && listenPoll.revents == 0))
+				continue;
+			int connection = accept4(listenSocket, nullptr, nullptr, SOCK_CLOEXEC);
+			if (connection < 0) {
+				if (errno == EINTR || errno == ECONNABORTED || errno == EAGAIN || errno == EWOULDBLOCK) {
+					acceptDelay = 0;
+					continue;
+				}
+				// only the first of a run of failures is reported
+				if (acceptDelay == 0)
+					std::cerr << "Could not accept connection: " << strerror(errno) << std::endl;
+				acceptDelay = std::min(std::max(acceptDelay * 2, 10L), MaxAcceptDelayMilliseconds);
+				continue;
+			}
+			acceptDelay = 0;
+			timeval timeout;
+			timeout.tv_sec = RequestTimeoutSeconds;
+			timeout.tv_usec = 0;
+			setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+			setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+			pool.submit([connection, &state]() {
+				serveRequest(connection, state);
+				close(connection);
+			});
+		}
+		pool.wait(); // running requests are finished before the libraries go away
+	}
+
+	pthread_sigmask(SIG_UNBLOCK, &blockedSignals, nullptr);
+	close(listenSocket);
+	unlink(args.serveSocket.c_str());
+	args.verbose && std::cerr << "Stopped serving" << std::endl;
+	return 0;
+}
+
+/**
+ * scans new and changed pbws in the watched directories until SIGINT or SIGTERM
+ * every result is written as a JSON line as soon as it is finished
+ * @returns the exit code
+ */
+int watchDirectories(PlatformList& platforms, ResultCache* cache, const ProgramArguments& args) {
+	DirectoryWatcher watcher(args.debounce, args.verbose);
+	for (auto itInput = args.inputFiles.begin(); itInput != args.inputFiles.end(); ++itInput) {
+		if (!isDirectory(itInput->c_str()) || !watcher.watch(*itInput)) {
+			std::cerr << "Could not watch \"" << *itInput << "\"" << std::endl;
+			return 3;
+		}
+	}
+
+	NdjsonWriter writer;
+	if (!writer.open(args.outputFile, args.outputCompression, args.jobs)) {
+		std::cerr << "Could not open output file" << std::endl;
+		return 5;
+	}
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = onStopSignal;
+	sigaction(SIGINT, &action, nullptr);
+	sigaction(SIGTERM, &action, nullptr);
+
+	std::vector<PblLibrary*> libraries;
+	for (auto itPlatform = platforms.begin(); itPlatform != platforms.end(); ++itPlatform) {
+		if (!(*itPlatform)->mappingOnly)
+			libraries.push_back(&(*itPlatform)->library);
+	}
+	BatchScanner scanner(libraries, args.jobs, args.verbose);
+	scanner.setResultCache(cache);
+	scanner.setBudget(args.budget);
+
+	std::vector<std::string> readyFiles;
+	std::atomic<bool> writeFailed(false);
+	while (!stopRequested && !writeFailed) {
+		readyFiles.clear();
+		if (!watcher.wait(readyFiles, -1))
+			return 3;
+		// the file may be gone again by the time it is quiet
+		readyFiles.erase(std::remove_if(readyFiles.begin(), readyFiles.end(), [](const std::string& path) {
+			return !isFile(path.c_str());
+		}), readyFiles.end());
+
+		scanner.scan(readyFiles, [&](uint32_t inputIndex, BatchScanner::AppResult& result) {
+			static thread_local std::string record;
+			NdjsonWriter::serialize(record, readyFiles[inputIndex], result, args.outputSymbolOffsets);
+			if (!writer.write(record))
+				writeFailed = true;
+		});
+		if (!writer.flush()) // compressed records would wait for a full block otherwise
+			writeFailed = true;
+	}
+
+	if (writeFailed) {
+		std::cerr << "Could not write to output file" << std::endl;
+		return 5;
+	}
+	return 0;
+}
+#endif
+
+std::string metadataErrorRecord(const std::string& inputFile, const char* error) {
+	return json11::Json(json11::Json::object {
+		{ "input", inputFile },
+		{ "error", error }
+	}).dump();
+}
+
+/**
+ * outputs the metadata record of a single input, of every frame of a stream or of every batch input,
+ * batch records are written as JSON lines in completion order
+ * @returns the exit code
+ */
+int outputMetadata(const ProgramArguments& args) {
+	if (args.batch) {
+		std::vector<std::string> inputs;
+		if (!collectBatchInputs(args, inputs))
+			return 3;
+		if (args.shardCount > 0)
+			inputs = shardInputs(inputs, args, nullptr);
+		NdjsonWriter writer;
+		if (!writer.open(args.outputFile, args.outputCompression, args.jobs)) {
+			std::cerr << "Could not open output file" << std::endl;
+			return 5;
+		}
+		std::atomic<bool> writeFailed(false);
+		{
+			ThreadPool pool(args.jobs);
+			for (auto itInput = inputs.begin(); itInput != inputs.end(); ++itInput) {
+				const std::string& input = *itInput;
+				pool.submit([&input, &writer, &writeFailed, &args]() {
+					PblAppArchive appArchive;
+					std::string record = appArchive.load(input.c_str(), args.verbose) ?
+						metadataRecord(appArchive, input, args.verbose) : metadataErrorRecord(input, "Could not open pebble app archive");
+					if (!writer.write(record + '\n'))
+						writeFailed = true;
+				});
+			}
+			pool.wait();
+		}
+		return writer.flush() && !writeFailed ? 0 : 5;
+	}
+
+	JsonWriter output;
+	if (args.stdinStream) {
+		if (!openOutput(output, args))
+			return 5;
+		std::vector<uint8_t> inputBuffer;
+		bool truncated = false, tooLarge = false;
+		uint32_t frameIndex = 0;
+		setBinaryStdin();
+		while (readStreamFrame(stdin, inputBuffer, MaxInlineInputSize, truncated, tooLarge)) {
+			PblAppArchive appArchive;
+			if (tooLarge)
+				output << metadataErrorRecord(args.inputFile, "Pebble app archive is too large") << '\n';
+			else if (!appArchive.loadFromMemory(inputBuffer.data(), inputBuffer.size(), args.verbose))
+				output << metadataErrorRecord(args.inputFile, "Could not open pebble app archive") << '\n';
+			else
+				output << metadataRecord(appArchive, args.inputFile, args.verbose) << '\n';
+			output.flush();
+			frameIndex++;
+		}
+		if (truncated) {
+			std::cerr << "Truncated stream after " << frameIndex << " pebble app archives" << std::endl;
+			return 3;
+		}
+		return output.flush() ? 0 : 5;
+	}
+
+	PblAppArchive appArchive;
+	std::vector<uint8_t> inputBuffer;
+	if (args.inputFile == "null" || !loadAppArchive(appArchive, args.inputFile, inputBuffer, args.verbose)) {
+		std::cerr << "Could not open pebble app archive" << std::endl;
+		return 3;
+	}
+	if (!openOutput(output, args))
+		return 5;
+	output << metadataRecord(appArchive, args.inputFile, args.verbose) << '\n';
+	return output.flush() ? 0 : 5;
+}
+
+/**
+ * The entrypoint to this program
+ */
+int main(int argc, char* argv[]) {
+	ProgramArguments args;
+	if (!parseArguments(args, argc, argv))
+		return 1;
+	if (args.inputFile == "null" && !args.mapLibFunctions && !args.batch && !args.watch && !args.merge && !args.decode && args.serveSocket == "") {
+		std::cerr << "Nothing to do." << std::endl;
+		return 6;
+	}
+
+	// Merging and decoding do not need any library
+	if (args.merge)
+		return args.aggregate ? mergeReports(args) : mergePartials(args);
+	if (args.decode)
+		return decodeCompact(args);
+
+	// Metadata does not need any library
+	if (args.metadataOnly)
+		return outputMetadata(args);
+	std::vector<uint8_t> inputBuffer;
+
+	StringPool functionNames;
+	PlatformList platforms;
+	if (!loadPlatforms(platforms, functionNames, args)) {
+		std::cerr << "Could not load any library" << std::endl;
+		cleanPlatforms(platforms);
+		return 2;
+	}
+
+	// Results of binaries that were already scanned with the same libraries
+	ResultCache resultCache;
+	ResultCache* cache = nullptr;
+	if (args.cacheFile != "") {
+		if (resultCache.open(args.cacheFile, args.verbose))
+			cache = &resultCache;
+		else
+			std::cerr << "Could not open result cache, scanning without it" << std::endl;
+	}
+
+#ifndef WIN32
+	if (args.serveSocket != "")
+		return serveSocket(platforms, cache, args);
+	if (args.watch) {
+		int result = watchDirectories(platforms, cache, args);
+		cleanPlatforms(platforms);
+		return result;
+	}
+#endif
+
+	if (args.batch) {
+		int result = scanBatch(platforms, cache, args);
+		cache != nullptr && args.verbose && std::cerr << "Result cache: " << cache->getHits() << " hits, " << cache->getMisses() << " misses" << std::endl;
+		cleanPlatforms(platforms);
+		return result;
+	}
+
+	if (args.stdinStream || args.bundle) {
+		JsonWriter output;
+		int result = 5;
+		if (openOutput(output, args) && args.stdinStream)
+			result = scanStdinStream(output, platforms, cache, args);
+		else if (output.good())
+			result = scanBundle(output, platforms, cache, args);
+		if (result == 0 && !output.flush())
+			result = 5;
+		cleanPlatforms(platforms);
+		return result;
+	}
+
+	// Load pebble app and detect API functions
+	// the archive and its input are released before the output, only the results of the binaries remain
+	std::vector<PblAppBinary*> binaries;
+	if (args.inputFile != "null") {
+		PblAppArchive appArchive;
+		if (!loadAppArchive(appArchive, args.inputFile, inputBuffer, args.verbose)) {
+			cleanPlatforms(platforms);
+			return 3;
+		}
+		InputBudget budget;
+		budget.start(args.budget);
+		if (!scanAppArchive(appArchive, platforms, binaries, cache, budget, args.jobs, args.verbose)) {
+			std::cerr << (budget.isExceeded() ? budget.getError() : "Could not scan any pebble binary") << std::endl;
+			cleanPlatforms(platforms);
+			return 4;
+		}
+	}
+	std::vector<uint8_t>().swap(inputBuffer);
+
+	// Output (as JSON)
+	JsonWriter output;
+	if (!openOutput(output, args))
+		return 5;
+	outputResult(output, platforms, args.inputFile != "null" ? &binaries : nullptr, args);
+	bool written = output.flush();
+
+	// Clean up and go home
+	cleanBinaries(binaries);
+	cleanPlatforms(platforms);
+
+	return written ? 0 : 5;
+}
@@ -3,10 +3,44 @@
 
 #include <string>
 #include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+#include <unordered_map>
+#include <map>
+#include <chrono>
 
 #include "../thirdparty/elfio/elfio/elfio.hpp"
 #include "../thirdparty/miniz/miniz_zip.h"
 
+#ifdef WIN32
+#define fseeko _fseeki64
+#define ftello _ftelli64
+#endif
+
+/**
+ * Streaming SHA-256, used to address scan results by the content of a binary
+ */
+class Sha256 {
+	uint32_t state[8];
+	uint64_t length;
+	uint8_t block[64];
+	size_t blockSize;
+
+	void transform(const uint8_t* data);
+public:
+	static constexpr size_t DigestSize = 32;
+
+	Sha256();
+
+	void update(const void* data, size_t size);
+	void finish(uint8_t* digest); // the hasher cannot be updated afterwards
+};
+
 /**
  * .a archive reader, following the SRV4/GNU variant
  */
@@ -23,7 +57,7 @@ class ArArchive {
 
 	struct FileEntry {
 		std::string name;
-		uint32_t size, offset;
+		uint64_t size, offset;
 		void* buffer;
 	};
 
@@ -39,28 +73,65 @@ public:
 	uint32_t getFileCount() const;
 	uint32_t getFileIndex(const char* name) const; // returns UINT32_MAX on failure
 	const char* getFileName(uint32_t index) const;
-	uint32_t getFileSize(uint32_t index) const; // returns 0 on failure
-	uint32_t getFileOffset(uint32_t index) const;
+	uint64_t getFileSize(uint32_t index) const; // returns 0 on failure
+	uint64_t getFileOffset(uint32_t index) const;
 	void* getFileBuffer(uint32_t index); // has to be mutable for streambuf to work
 };
 
+/**
+ * Stores every distinct string once and numbers them, a string never moves until the pool is destroyed.
+ * Interning is not thread safe, reading is once nothing is interned anymore.
+ */
+class StringPool {
+	std::vector<char*> blocks;
+	size_t blockUsed; // bytes used of the last block
+	std::vector<const char*> strings; // indexed by id
+	std::vector<uint32_t> lengths, hashes;
+	std::vector<uint32_t> slots; // open addressing hash table of ids
+
+	char* allocate(size_t size);
+	void growSlots();
+public:
+	StringPool();
+	~StringPool();
+	StringPool(const StringPool&) = delete;
+	StringPool& operator=(const StringPool&) = delete;
+
+	uint32_t intern(const char* str, size_t length);
+	uint32_t intern(const std::string& str);
+
+	const char* getString(uint32_t id) const; // returns nullptr for an unknown id
+	uint32_t getLength(uint32_t id) const;
+	uint32_t getCount() const;
+};
+
 /**
  * A pebble import library
+ * Only the code of the functions is kept, the ELF file is released after loading.
+ * Function names may be interned in a pool shared by several libraries, e.g. all platforms of several SDKs.
  */
 class PblLibrary {
 	struct Function {
-		ELFIO::section* section;
-		std::string name;
+		uint32_t nameId; // in the string pool
+		uint32_t codeOffset; // in code
+		uint32_t codeSize;
 		uint32_t relocatedOffset; // a 4 byte long relocation entry, which has to be ignored
 		uint32_t symbolTableOffset; // the index in the symbol table
 	};
 
-	ELFIO::elfio elf;
+	StringPool* names;
+	bool ownsNames;
 	std::vector<Function> functions;
+	std::vector<uint8_t> code; // the code of all functions
 	std::string platformName;
+	uint8_t signature[Sha256::DigestSize];
+
+	void computeSignature();
 public:
-	PblLibrary(const char* platformName);
+	PblLibrary(const char* platformName, StringPool* functionNames = nullptr); // without a pool the library has its own
 	~PblLibrary();
+	PblLibrary(const PblLibrary&) = delete;
+	PblLibrary& operator=(const PblLibrary&) = delete;
 
 	bool loadFromArArchive(ArArchive& archive, bool verbose);
 	bool loadFromELF(ELFIO::Loader* loader, bool verbose);
@@ -68,32 +139,13 @@ public:
 	const char* getPlatformName() const;
 	uint32_t getFunctionCount() const;
 	const char* getFunctionName(uint32_t index) const;
+	uint32_t getFunctionNameId(uint32_t index) const; // equal ids are equal names if the pool is shared, UINT32_MAX on failure
+	const StringPool& getFunctionNames() const;
 	const void* getFunctionCode(uint32_t index) const;
 	uint32_t getFunctionCodeSize(uint32_t index) const;
 	uint32_t getFunctionRelocatedOffset(uint32_t index) const;
 	uint32_t getFunctionSymbolTableOffset(uint32_t index) const;
-};
-
-/**
- * A pebble app archive
- */
-class PblAppArchive {
-	struct BinaryInfo {
-		uint32_t fileIndex;
-		std::string platform;
-	};
-
-	mz_zip_archive archive;
-	std::vector<BinaryInfo> binaries;
-public:
-	PblAppArchive();
-	~PblAppArchive();
-
-	bool load(const char* filename, bool verbose);
-
-	uint32_t getBinaryCount() const;
-	const char* getBinaryPlatform(uint32_t index) const;
-	void* extractBinary(uint32_t index, uint32_t* size, bool verbose);
+	const uint8_t* getSignature() const; // a hash of everything the scan result depends on
 };
 
 /**
@@ -123,26 +175,802 @@ struct PblAppHeader {
 };
 #pragma pack(pop)
 
+/**
+ * Limits for the work spent on a single input, shared by all of its binaries
+ * Inflating and scanning check the budget regularly and give up once it is exceeded,
+ * so a zip bomb or a pathological binary cannot hold a worker thread for long.
+ */
+class InputBudget {
+public:
+	struct Limits {
+		uint64_t inflatedSize = 0; // bytes of all binaries, 0 is unlimited
+		uint32_t milliseconds = 0; // wall time since the input was opened, 0 is unlimited
+		uint64_t scanBytes = 0; // binary bytes searched for library functions, 0 is unlimited
+	};
+
+	enum Limit {
+		Limit_None,
+		Limit_InflatedSize,
+		Limit_Time,
+		Limit_ScanBytes
+	};
+private:
+	Limits limits;
+	std::chrono::steady_clock::time_point deadline;
+	std::atomic<uint64_t> inflatedSize, scanBytes;
+	std::atomic<int> exceeded;
+
+	bool exceed(Limit limit);
+public:
+	InputBudget();
+
+	void start(const Limits& limits); // the clock starts now
+
+	bool reserveInflate(uint64_t size); // before the output is allocated
+	bool chargeScan(uint64_t size);
+	bool checkTime();
+	bool isExceeded() const;
+	std::string getError() const;
+};
+
+/**
+ * A pebble app archive
+ * The central directory is parsed once by load, after that extractBinary
+ * may be called from any number of threads at the same time.
+ */
+class PblAppArchive {
+	struct FileInfo {
+		uint32_t fileIndex;
+		uint64_t localHeaderOffset;
+		uint64_t compressedSize, uncompressedSize;
+		uint32_t method, crc32;
+	};
+
+	struct BinaryInfo {
+		FileInfo file;
+		std::string platform;
+	};
+
+	mz_zip_archive archive;
+#ifdef WIN32
+	FILE* file;
+	std::mutex fileMutex;
+#else
+	int fileDescriptor;
+#endif
+	std::vector<BinaryInfo> binaries;
+	FileInfo appInfo;
+	bool hasAppInfo;
+
+	static size_t readArchive(void* opaque, mz_uint64 offset, void* buffer, size_t size);
+	bool findFiles(bool verbose);
+	bool statFile(uint32_t fileIndex, FileInfo& info);
+	// inflation stops early if outputSize is smaller than the file
+	mz_zip_error inflateFile(const FileInfo& info, uint8_t* output, size_t outputSize, Sha256* hasher = nullptr, InputBudget* budget = nullptr) const;
+public:
+	PblAppArchive();
+	~PblAppArchive();
+
+	bool load(const char* filename, bool verbose);
+	bool loadFromMemory(const void* data, size_t size, bool verbose); // data has to outlive the archive
+
+	uint32_t getBinaryCount() const;
+	const char* getBinaryPlatform(uint32_t index) const;
+	// hash receives the SHA-256 of the binary, nullptr is returned as well if the budget is exceeded
+	void* extractBinary(uint32_t index, size_t* size, bool verbose, uint8_t* hash = nullptr, InputBudget* budget = nullptr) const;
+	bool extractBinaryHeader(uint32_t index, PblAppHeader* header, bool verbose) const;
+	bool extractAppInfo(std::string& json, bool verbose) const;
+};
+
+/**
+ * A zip or tar bundle of pebble app archives
+ * The .pbw members are read one after another, nothing is unpacked to disk.
+ */
+class PblBundle {
+	enum Type {
+		Type_None,
+		Type_Zip,
+		Type_Tar
+	};
+
+	Type type;
+	mz_zip_archive zipArchive;
+	uint32_t zipIndex;
+	FILE* tarFile;
+	uint64_t tarFileSize;
+	uint64_t maxMemberSize;
+	bool failed;
+
+	bool nextZipApp(std::string& name, std::vector<uint8_t>& buffer, std::string& error, bool verbose);
+	bool nextTarApp(std::string& name, std::vector<uint8_t>& buffer, std::string& error, bool verbose);
+public:
+	PblBundle();
+	~PblBundle();
+
+	bool load(const char* filename, bool verbose);
+	void setMaxMemberSize(uint64_t size); // larger members are skipped with an error
+
+	// reads the next .pbw member into buffer, returns false at the end of the bundle
+	// a member that cannot be read is returned with an empty buffer and the error
+	bool nextApp(std::string& name, std::vector<uint8_t>& buffer, std::string& error, bool verbose);
+	bool hasFailed() const; // the bundle is broken, nextApp stopped before its end
+};
+
 /**
  * A pebble app binary
  */
+class ResultCache;
+
 class PblAppBinary {
 	PblLibrary* library;
 	void* buffer;
-	uint32_t size;
+	size_t size;
 	std::vector<uint32_t> usedFunctions;
+	uint8_t uuid[16]; // kept from the header when the buffer is released
+	uint16_t sdkVersion;
 public:
-	PblAppBinary(void* buffer, uint32_t size, PblLibrary* library);
+	PblAppBinary(void* buffer, size_t size, PblLibrary* library);
+	PblAppBinary(PblLibrary* library, const std::vector<uint32_t>& usedFunctions, const uint8_t* uuid, uint16_t sdkVersion); // a result scanned elsewhere, without buffer
 	~PblAppBinary();
 
-	uint32_t scan();
+	uint32_t scan(InputBudget* budget = nullptr); // stops early if the budget is exceeded
+	uint32_t scan(ResultCache* cache, const uint8_t* binaryHash, InputBudget* budget = nullptr); // scans only if the cache does not know the binary
+	void releaseBuffer(); // the header is not available anymore
 
 	const char* getPlatformName() const;
 	const PblAppHeader* getHeader() const;
+	const uint8_t* getUUID() const;
+	uint16_t getSdkVersion() const; // major version in the high byte
 	uint32_t getUsedFunctionCount() const;
 	uint32_t getUsedFunctionIndex(uint32_t index) const;
 	const char* getUsedFunctionName(uint32_t index) const;
 	uint32_t getUsedFunctionSymbolTableOffset(uint32_t index) const;
 };
 
+/**
+ * Scan results on disk, addressed by the hash of the binary and the signature of the library
+ * Records are only appended, every record is written by a single write while holding an
+ * exclusive file lock, so many processes can share one cache file.
+ */
+class ResultCache {
+	struct Entry {
+		const uint8_t* mappedFunctions; // little endian, inside the mapping, nullptr for new entries
+		uint32_t functionCount;
+		std::vector<uint32_t> functions; // new entries only
+	};
+
+	int fd;
+	void* mapping;
+	size_t mappingSize;
+	std::mutex mutex;
+	std::unordered_map<std::string, Entry> entries;
+	std::atomic<uint32_t> hits, misses;
+
+	static std::string makeKey(const uint8_t* binaryHash, const PblLibrary& library);
+	bool readRecords(uint64_t& validSize);
+public:
+	ResultCache();
+	~ResultCache();
+
+	bool open(const std::string& path, bool verbose);
+	bool lookup(const uint8_t* binaryHash, const PblLibrary& library, std::vector<uint32_t>& functions);
+	bool store(const uint8_t* binaryHash, const PblLibrary& library, const std::vector<uint32_t>& functions);
+
+	uint32_t getHits() const;
+	uint32_t getMisses() const;
+};
+
+/**
+ * Journal of the finished inputs of a batch, an interrupted batch can be resumed from it
+ * Results are appended to a data file and the journal records where the result of every input
+ * is. Both are synced in groups, the data file first, so the journal never points at lost data.
+ */
+class BatchJournal {
+	struct Entry {
+		uint64_t offset;
+		uint32_t size;
+	};
+
+	int journalFd;
+	int dataFd;
+	uint64_t dataSize;
+	bool verbose;
+	std::mutex mutex;
+	std::unordered_map<std::string, Entry> entries;
+	std::string pendingRecords; // journal records waiting for the next sync
+	uint32_t pendingCount;
+	std::chrono::steady_clock::time_point lastSync;
+
+	bool readRecords(const std::string& journal, uint32_t flags, uint64_t& validSize, uint64_t& dataEnd);
+	bool syncPending();
+public:
+	enum Flags {
+		Flag_Ndjson = 1,
+		Flag_SymbolOffsets = 2
+	};
+
+	BatchJournal(bool verbose);
+	~BatchJournal();
+
+	// starts a new journal or continues an existing one, which had to be written with the same flags
+	bool open(const std::string& journalPath, const std::string& dataPath, uint32_t flags, bool resume);
+	bool isFinished(const std::string& input);
+	bool readResult(const std::string& input, std::string& result);
+	bool append(const std::string& input, const std::string& result);
+	bool sync();
+	uint32_t getFinishedCount();
+};
+
+/**
+ * A work-stealing thread pool
+ * Every worker has its own task queue, tasks submitted from a worker go to its own queue.
+ * Idle workers steal the oldest tasks of other workers.
+ */
+class ThreadPool {
+	struct Worker {
+		std::deque<std::function<void()>> tasks;
+		std::mutex mutex;
+	};
+
+	std::vector<Worker*> workers;
+	std::vector<std::thread> threads;
+	std::mutex stateMutex;
+	std::condition_variable taskAvailable, allDone;
+	uint32_t queuedTasks, pendingTasks;
+	uint32_t nextWorker;
+	bool stopping;
+
+	bool popTask(uint32_t workerIndex, std::function<void()>& task);
+	void run(uint32_t workerIndex);
+public:
+	ThreadPool(uint32_t threadCount); // 0 uses one thread per core
+	~ThreadPool();
+
+	uint32_t getThreadCount() const;
+	void submit(std::function<void()> task);
+	void wait(); // blocks until every submitted task is finished
+};
+
+/**
+ * Scans many pebble app archives with one shared set of libraries
+ * Every binary of every archive is a separate task in the thread pool.
+ */
+class BatchScanner {
+public:
+	struct AppResult {
+		std::vector<PblAppBinary*> binaries; // the binary buffers are already released
+		std::vector<std::string> errors;
+
+		AppResult();
+		~AppResult();
+		AppResult(const AppResult&) = delete;
+		AppResult& operator=(const AppResult&) = delete;
+	};
+
+	// called from the worker threads as soon as an input is finished
+	typedef std::function<void(uint32_t inputIndex, AppResult& result)> ResultCallback;
+private:
+	struct AppJob;
+
+	std::vector<PblLibrary*> libraries;
+	ThreadPool pool;
+	ResultCache* cache;
+	InputBudget::Limits budgetLimits;
+	bool verbose;
+
+	PblLibrary* findLibrary(const char* platformName) const;
+	void openApp(uint32_t inputIndex, const std::string& input, const ResultCallback& callback);
+	void scanBinary(std::shared_ptr<AppJob> job, uint32_t binaryIndex, const ResultCallback& callback);
+	void finishApp(AppJob& job, const ResultCallback& callback);
+public:
+	BatchScanner(const std::vector<PblLibrary*>& libraries, uint32_t threadCount, bool verbose);
+
+	void setResultCache(ResultCache* cache); // nullptr scans every binary
+	void setBudget(const InputBudget::Limits& limits); // for every input
+
+	void scan(const std::vector<std::string>& inputs, const ResultCallback& callback);
+};
+
+/**
+ * Scans batch inputs in forked worker processes, so a crash in a parser only loses one input
+ * The libraries are loaded by the parent before the workers are forked and shared copy-on-write.
+ * Every worker gets one input at a time over a socket pair and answers with the compact result
+ * (library index and function indices), a worker that dies is restarted and its input fails.
+ */
+class WorkerPool {
+	struct Worker {
+		int pid;
+		int fd;
+		int32_t inputIndex; // -1 while idle
+		std::chrono::steady_clock::time_point started;
+	};
+
+	std::vector<PblLibrary*> libraries;
+	std::vector<Worker> workers;
+	std::string cacheFile;
+	InputBudget::Limits budgetLimits;
+	uint32_t restarts;
+	bool verbose;
+
+	bool startWorker(Worker& worker);
+	void stopWorker(Worker& worker, bool kill);
+	void runWorker(int fd); // in the child, never returns
+	bool dispatch(Worker& worker, uint32_t inputIndex, const std::string& input);
+	bool parseResult(const std::string& message, BatchScanner::AppResult& result) const;
+public:
+	WorkerPool(const std::vector<PblLibrary*>& libraries, uint32_t workerCount, bool verbose);
+	~WorkerPool();
+
+	void setResultCacheFile(const std::string& path); // every worker opens the cache on its own
+	void setBudget(const InputBudget::Limits& limits); // for every input
+
+	// the callback is called on the calling thread as soon as an input is finished
+	void scan(const std::vector<std::string>& inputs, const BatchScanner::ResultCallback& callback);
+};
+
+/**
+ * A bounded lock-free queue for many producers and consumers (Dmitry Vyukov's ring buffer)
+ * Every cell has a sequence number telling whether it may be written or read in the current lap.
+ */
+template<typename T>
+class BoundedQueue {
+	struct Cell {
+		std::atomic<size_t> sequence;
+		T data;
+	};
+
+	std::unique_ptr<Cell[]> cells;
+	size_t mask;
+	alignas(64) std::atomic<size_t> enqueuePosition;
+	alignas(64) std::atomic<size_t> dequeuePosition;
+public:
+	BoundedQueue(size_t capacity) { // rounded up to a power of two
+		size_t size = 2;
+		while (size < capacity)
+			size *= 2;
+		cells.reset(new Cell[size]);
+		for (size_t i = 0; i < size; i++)
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+		mask = size - 1;
+		enqueuePosition.store(0, std::memory_order_relaxed);
+		dequeuePosition.store(0, std::memory_order_relaxed);
+	}
+
+	bool tryPush(const T& value) {
+		size_t position = enqueuePosition.load(std::memory_order_relaxed);
+		while (true) {
+			Cell& cell = cells[position & mask];
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+			if (diff == 0) {
+				if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+					cell.data = value;
+					cell.sequence.store(position + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0)
+				return false; // full
+			else
+				position = enqueuePosition.load(std::memory_order_relaxed);
+		}
+	}
+
+	bool tryPop(T& value) {
+		size_t position = dequeuePosition.load(std::memory_order_relaxed);
+		while (true) {
+			Cell& cell = cells[position & mask];
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+			if (diff == 0) {
+				if (dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+					value = cell.data;
+					cell.sequence.store(position + mask + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0)
+				return false; // empty
+			else
+				position = dequeuePosition.load(std::memory_order_relaxed);
+		}
+	}
+};
+
+/**
+ * Keeps the buffers of whole input files for reuse, the reader and the emitter run on different threads
+ */
+class BufferPool {
+	std::mutex mutex;
+	std::vector<std::vector<uint8_t>*> buffers;
+	size_t maxBuffers;
+public:
+	BufferPool(size_t maxBuffers);
+	~BufferPool();
+
+	std::vector<uint8_t>* acquire();
+	void release(std::vector<uint8_t>* buffer);
+};
+
+/**
+ * Reads whole input files with many reads in flight (io_uring on linux) or one blocking pread at a time
+ * Completed files are returned in completion order, not in submission order.
+ */
+class CorpusReader {
+public:
+	enum Mode {
+		Mode_Pread,
+		Mode_Uring
+	};
+
+	struct File {
+		uint32_t index;
+		std::vector<uint8_t>* buffer; // nullptr if the file could not be read
+	};
+private:
+	struct Request;
+	struct Ring;
+
+	Mode mode;
+	BufferPool& pool;
+	bool verbose;
+	std::vector<Request*> requests; // one per read in flight
+	std::vector<uint32_t> freeRequests;
+	std::deque<File> completed;
+	Ring* ring;
+	uint64_t bytesRead;
+
+	bool setupRing(uint32_t depth);
+	void cleanRing();
+	bool submitOpen(uint32_t requestIndex);
+	bool submitRead(uint32_t requestIndex);
+	void complete(uint32_t requestIndex, bool success);
+	void handleCompletion(uint32_t requestIndex, int32_t result);
+	bool readBlocking(const std::string& path, std::vector<uint8_t>& buffer);
+public:
+	CorpusReader(Mode mode, uint32_t depth, BufferPool& pool, bool verbose); // falls back to pread without io_uring
+	~CorpusReader();
+
+	Mode getMode() const;
+	uint64_t getBytesRead() const;
+	bool canSubmit() const;
+	uint32_t inFlight() const;
+	void submit(uint32_t index, const std::string& path);
+	bool next(File& file); // blocks until a file is complete, false if nothing is in flight
+};
+
+/**
+ * Scans many pebble app archives in separate stages: read -> inflate -> scan -> emit
+ * Every stage has its own threads, the stages are connected by bounded queues so a slow
+ * stage blocks the previous ones instead of buffering extracted binaries.
+ * Results are emitted in input order on the calling thread.
+ */
+class BatchPipeline {
+public:
+	struct Config {
+		uint32_t readThreads = 1;
+		uint32_t inflateThreads = 1;
+		uint32_t scanThreads = 0; // 0 uses the remaining cores
+		uint32_t window = 0; // maximum number of apps in flight, 0 derives it from the thread counts
+		bool prefetch = false; // read whole inputs up front instead of the parts miniz asks for
+		CorpusReader::Mode prefetchMode = CorpusReader::Mode_Uring;
+		uint32_t prefetchDepth = 32; // reads in flight per read thread
+	};
+private:
+	struct AppJob;
+	struct BinaryItem {
+		AppJob* job;
+		uint32_t binaryIndex;
+		void* buffer;
+		size_t size;
+		uint8_t hash[Sha256::DigestSize];
+	};
+
+	std::vector<PblLibrary*> libraries;
+	Config config;
+	ResultCache* cache;
+	InputBudget::Limits budgetLimits;
+	bool verbose;
+
+	const std::vector<std::string>* inputs;
+	BufferPool bufferPool;
+	std::atomic<uint64_t> bytesRead;
+	std::atomic<uint32_t> nextInput, emittedCount;
+	std::atomic<uint32_t> activeReaders, activeInflaters, activeScanners;
+	BoundedQueue<BinaryItem> inflateQueue, scanQueue;
+	BoundedQueue<AppJob*> emitQueue;
+
+	PblLibrary* findLibrary(const char* platformName) const;
+	bool claimInput(uint32_t& inputIndex);
+	void startApp(uint32_t inputIndex, std::vector<uint8_t>* buffer);
+	void runReader();
+	void runPrefetchReader();
+	void runInflater();
+	void runScanner();
+	void finishApp(AppJob* job);
+public:
+	BatchPipeline(const std::vector<PblLibrary*>& libraries, const Config& config, bool verbose);
+
+	void setResultCache(ResultCache* cache); // nullptr scans every binary
+	void setBudget(const InputBudget::Limits& limits); // for every input
+
+	// the callback is called on the calling thread, in input order
+	void scan(const std::vector<std::string>& inputs, const BatchScanner::ResultCallback& callback);
+};
+
+/**
+ * Finds the pbws below a directory on several threads
+ * Directories are listed with getdents64 and the type of every entry is taken from d_type, so only
+ * file systems that do not report it need a stat. The result is sorted like a depth-first walk
+ * with sorted entries, independent of the thread timing.
+ */
+class DirectoryWalker {
+	std::vector<std::string> includes; // globs on the path below the walked directory
+	std::vector<std::string> excludes;
+	uint32_t threadCount;
+	bool verbose;
+
+	std::mutex mutex;
+	std::condition_variable workAvailable;
+	std::deque<std::string> pendingDirectories; // relative to the root
+	uint32_t activeThreads;
+	std::string root;
+	std::vector<std::string> found;
+
+	void run();
+	void readDirectory(const std::string& directory, std::vector<std::string>& directories, std::vector<std::string>& files);
+	bool isIncluded(const std::string& path) const;
+	bool isExcluded(const std::string& path) const;
+public:
+	DirectoryWalker(uint32_t threadCount, bool verbose); // 0 threads means one per core
+
+	void setFilters(const std::vector<std::string>& includes, const std::vector<std::string>& excludes); // no includes means *.pbw
+
+	// appends the paths of all matching files below directory
+	bool walk(const std::string& directory, std::vector<std::string>& paths);
+};
+
+/**
+ * Watches directories and their subdirectories with inotify (linux only)
+ * A changed pbw is reported once it was not written to for the debounce time, so files
+ * that are still being copied are not scanned half-written.
+ */
+class DirectoryWatcher {
+	int fd;
+	std::unordered_map<int, std::string> directories; // by watch descriptor
+	std::map<std::string, std::chrono::steady_clock::time_point> pending; // when a pbw is quiet long enough
+	uint32_t debounce; // milliseconds
+	bool verbose;
+
+	void handleEvent(int wd, uint32_t mask, const char* name);
+	void collectArchives(const std::string& directory, std::vector<std::string>& archives);
+public:
+	DirectoryWatcher(uint32_t debounceMilliseconds, bool verbose);
+	~DirectoryWatcher();
+
+	bool watch(const std::string& path);
+	// adds the pbws that became ready, returns early on a signal and false if watching failed
+	bool wait(std::vector<std::string>& readyFiles, int timeoutMilliseconds);
+};
+
+/**
+ * Compresses a stream into a gzip file of many members
+ * The data is cut into blocks, each is compressed into an independent gzip member on a thread pool
+ * and the members are written in order. gzip readers decompress the concatenation as one stream.
+ */
+class GzipStream {
+	int fileDescriptor;
+	int compressionFlags;
+	std::string block; // collects the next member
+	uint64_t nextBlock, nextWrite;
+	uint32_t blocksInFlight;
+	std::atomic<bool> failed;
+	std::map<uint64_t, std::string> compressed; // members waiting for the previous ones
+	std::mutex mutex;
+	std::condition_variable blockWritten;
+	ThreadPool pool; // destroyed first, its tasks use everything else
+
+	void submitBlock(bool force);
+	void compressBlock(uint64_t sequence, std::string* data);
+public:
+	GzipStream(int fd, int level, uint32_t threads); // 0 threads uses one per core
+	~GzipStream(); // writes everything left
+
+	bool write(const void* data, size_t size);
+	bool flush(); // ends the current member and waits until all are written
+	bool good() const;
+};
+
+/**
+ * A buffered writer for the JSON documents
+ * Output is collected in a reusable buffer and written to the file in large blocks, or kept in
+ * memory if no file is opened. Numbers and escaped strings are formatted without allocations.
+ * Compressed output goes through a GzipStream.
+ */
+class JsonWriter {
+	int fileDescriptor;
+	bool ownsFile;
+	bool failed;
+	std::string buffer;
+	GzipStream* gzip; // nullptr if the output is not compressed
+
+	void writeBuffer();
+public:
+	JsonWriter(); // writes into memory until a file is opened
+	~JsonWriter(); // flushes
+
+	bool open(const std::string& path, int compressionLevel = -1, uint32_t threads = 0); // "" is stdout, levels 0 to 10 write gzip
+
+	JsonWriter& operator<<(char c);
+	JsonWriter& operator<<(const char* str);
+	JsonWriter& operator<<(const std::string& str);
+	JsonWriter& operator<<(uint32_t value);
+	void writeRepeated(char c, uint32_t count);
+	void writeString(const std::string& str); // quoted and escaped
+	static void appendString(std::string& out, const char* str, size_t length); // quoted and escaped, for records built without a writer
+
+	bool flush(); // writes everything buffered so far to the file
+	bool good() const;
+	const std::string& str() const; // everything written so far if no file is open
+};
+
+/**
+ * Writes newline delimited JSON, every record is appended with a single write call
+ */
+class NdjsonWriter {
+	int fileDescriptor;
+	bool ownsFile;
+	std::mutex writeMutex;
+	GzipStream* gzip; // nullptr if the output is not compressed
+public:
+	NdjsonWriter();
+	~NdjsonWriter();
+
+	bool open(const std::string& path, int compressionLevel = -1, uint32_t threads = 0); // "" is stdout, levels 0 to 10 write gzip
+	bool flush(); // only needed for compressed output, records are written right away otherwise
+
+	// serializes a batch result into record (including the newline), record is reused
+	static void serialize(std::string& record, const std::string& input, const BatchScanner::AppResult& result, bool asSymbolOffset);
+	bool write(const std::string& record);
+};
+
+/**
+ * Counts the apps that use each function, per platform and SDK version
+ * Every thread counts into tables of its own without any lock, the tables are only added up once
+ * all results are in. Totals of other runs, e.g. of other shards, can be added as well.
+ */
+class UsageAggregator {
+public:
+	struct FunctionTotals {
+		std::string name; // "" if no function has the symbol table offset
+		uint32_t apps = 0;
+		uint16_t firstSdk = UINT16_MAX; // lowest and highest SDK version of the apps using it
+		uint16_t lastSdk = 0;
+	};
+
+	struct PlatformTotals {
+		std::string name;
+		uint32_t binaries = 0;
+		std::map<uint16_t, uint32_t> sdkVersions; // binaries per SDK version
+		std::vector<FunctionTotals> functions; // indexed by symbol table offset
+	};
+private:
+	struct ThreadTables;
+
+	uint64_t id; // tells the tables of this aggregator apart in the thread local cache
+	uint32_t apps, failedApps;
+	std::vector<PlatformTotals> platforms;
+	std::mutex mutex; // only taken when a thread starts counting
+	std::vector<ThreadTables*> threadTables;
+
+	ThreadTables& tablesOfThread();
+	static void addPlatform(PlatformTotals& totals, const PlatformTotals& other);
+public:
+	UsageAggregator(const std::vector<PblLibrary*>& libraries); // no libraries for adding up totals only
+	~UsageAggregator();
+	UsageAggregator(const UsageAggregator&) = delete;
+	UsageAggregator& operator=(const UsageAggregator&) = delete;
+
+	void add(const BatchScanner::AppResult& result);
+	void finish(); // adds up the tables of all threads, no add may be running
+	void addTotals(uint32_t apps, uint32_t failedApps, const std::vector<PlatformTotals>& platforms);
+
+	uint32_t getAppCount() const;
+	uint32_t getFailedAppCount() const; // apps without any scanned binary
+	const std::vector<PlatformTotals>& getPlatforms() const;
+};
+
+/**
+ * Function map
+ * The function names behind every symbol table offset of any number of libraries, e.g. all platforms of several SDKs.
+ * Names are interned, so an offset keeps its distinct names as ids in the order they were added.
+ */
+class FunctionMap {
+private:
+	std::vector<std::string> names; // indexed by name id
+	std::unordered_map<std::string, uint32_t> nameIds;
+	std::vector<uint64_t> entries; // symbol table offset << 32 | name id, in the order they were added
+	std::vector<uint32_t> offsetStart; // index of the first name id of an offset in offsetNames
+	std::vector<uint32_t> offsetNames;
+	const StringPool* libraryNames; // the pool of the last added library
+	std::vector<uint32_t> libraryNameIds; // name id per id in libraryNames, UINT32_MAX if not known yet
+
+	uint32_t internName(const std::string& name);
+	void addEntry(uint32_t symbolTableOffset, uint32_t nameId);
+public:
+	FunctionMap();
+
+	void reserve(uint32_t symbolTableSize, size_t nameCount);
+	void add(uint32_t symbolTableOffset, const std::string& name);
+	void addLibrary(const PblLibrary& library);
+	void finish(); // groups the names by offset, has to be called after the last add
+
+	uint32_t getSymbolTableSize() const;
+	uint32_t getNameCount(uint32_t symbolTableOffset) const;
+	const std::string& getName(uint32_t symbolTableOffset, uint32_t index) const;
+};
+
+/**
+ * Scan results of many apps in a compact binary file, for corpus-scale storage
+ * The header maps the symbol table offsets of every platform to function names, a record holds
+ * the app UUID, the SDK version of every binary and a bitset of its used symbol table offsets.
+ * Records are only appended and every bitset is 8 byte aligned, so a mapped file can be
+ * combined with bitwise operations.
+ */
+class CompactResultFile {
+public:
+	struct Platform {
+		std::string name;
+		uint8_t signature[Sha256::DigestSize];
+		std::vector<std::string> functionNames; // indexed by symbol table offset, "" if no function has it
+	};
+
+	// the result of one binary inside a mapped record
+	class Binary {
+		const Platform* platform;
+		uint16_t sdkVersion;
+		const uint8_t* bits; // one bit per symbol table offset, in little endian words of 64 bits
+		std::vector<uint32_t> usedOffsets;
+	public:
+		Binary(const Platform* platform, uint16_t sdkVersion, const uint8_t* bits);
+
+		const char* getPlatformName() const;
+		uint16_t getSdkVersion() const; // major version in the high byte
+		const uint8_t* getBits() const;
+		uint32_t getUsedFunctionCount() const;
+		const char* getUsedFunctionName(uint32_t index) const;
+		uint32_t getUsedFunctionSymbolTableOffset(uint32_t index) const;
+	};
+
+	struct Record {
+		uint8_t uuid[16]; // of the first binary, zero if there is none
+		std::string input;
+		std::vector<Binary> binaries;
+		std::vector<std::string> errors;
+	};
+private:
+	int fd;
+	void* mapping;
+	size_t mappingSize;
+	std::vector<Platform> platforms;
+	std::vector<size_t> recordOffsets; // inside the mapping
+	std::mutex mutex;
+
+	bool readFile(uint64_t& validSize);
+	void unmap();
+public:
+	CompactResultFile();
+	~CompactResultFile();
+
+	// appends to an existing file if it was written with the same libraries
+	bool create(const std::string& path, const std::vector<PblLibrary*>& libraries, bool verbose);
+	bool append(const std::string& input, const BatchScanner::AppResult& result);
+
+	bool load(const std::string& path, bool verbose); // maps the file for reading
+	uint32_t getPlatformCount() const;
+	const Platform& getPlatform(uint32_t index) const;
+	uint32_t getRecordCount() const;
+	void getRecord(uint32_t index, Record& record) const;
+};
+
 #endif // PBW_API_INFO_H